@@ -0,0 +1,168 @@
+#include "ArtStats.h"
+
+namespace {
+constexpr size_t stageCount = size_t(ArtStats::Stage::count);
+constexpr size_t outcomeCount = size_t(ArtStats::Outcome::count);
+
+struct AtomicHistogram {
+  std::array<std::atomic<uint64_t>, ArtStats::bucketCount> buckets{};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> totalMicros = 0;
+  std::atomic<uint64_t> maxMicros = 0;
+};
+
+struct Counters {
+  std::array<AtomicHistogram, stageCount> stages;
+  std::array<std::atomic<uint64_t>, outcomeCount> outcomes{};
+};
+
+Counters& counters() {
+  // Never destroyed, loader threads might still record during shutdown
+  static auto* counters = new Counters();
+  return *counters;
+}
+
+int bucketFor(uint64_t micros) {
+  int bucket = 0;
+  while (bucket < ArtStats::bucketCount - 1 && (uint64_t{1} << bucket) <= micros)
+    bucket++;
+  return bucket;
+}
+
+double bucketLimit(int bucket) {
+  return double(uint64_t{1} << bucket) / 1e6;
+}
+}  // namespace
+
+void ArtStats::record(Stage stage, double seconds) {
+  auto micros = uint64_t(std::max(0.0, seconds) * 1e6);
+  auto& histogram = counters().stages[size_t(stage)];
+  histogram.buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+  histogram.count.fetch_add(1, std::memory_order_relaxed);
+  histogram.totalMicros.fetch_add(micros, std::memory_order_relaxed);
+  uint64_t max = histogram.maxMicros.load(std::memory_order_relaxed);
+  while (max < micros && !histogram.maxMicros.compare_exchange_weak(
+                             max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+void ArtStats::count(Outcome outcome) {
+  counters().outcomes[size_t(outcome)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ArtStats::reset() {
+  auto& all = counters();
+  for (auto& histogram : all.stages) {
+    for (auto& bucket : histogram.buckets) bucket.store(0, std::memory_order_relaxed);
+    histogram.count.store(0, std::memory_order_relaxed);
+    histogram.totalMicros.store(0, std::memory_order_relaxed);
+    histogram.maxMicros.store(0, std::memory_order_relaxed);
+  }
+  for (auto& outcome : all.outcomes) outcome.store(0, std::memory_order_relaxed);
+}
+
+double ArtStats::Histogram::mean() const {
+  return count > 0 ? totalSeconds / double(count) : 0.0;
+}
+
+double ArtStats::Histogram::quantile(double fraction) const {
+  if (count == 0)
+    return 0.0;
+  auto target = uint64_t(std::ceil(fraction * double(count)));
+  uint64_t seen = 0;
+  for (int i = 0; i < bucketCount; i++) {
+    seen += buckets[i];
+    if (seen >= target)
+      return std::min(bucketLimit(i), maxSeconds);
+  }
+  return maxSeconds;
+}
+
+ArtStats::Snapshot ArtStats::getSnapshot() {
+  // The counters are read one by one, so a snapshot taken while loading can be off by
+  // the few samples recorded meanwhile
+  auto& all = counters();
+  Snapshot snapshot{};
+  for (size_t s = 0; s < stageCount; s++) {
+    const auto& source = all.stages[s];
+    auto& target = snapshot.stages[s];
+    for (int i = 0; i < bucketCount; i++)
+      target.buckets[i] = source.buckets[i].load(std::memory_order_relaxed);
+    target.count = source.count.load(std::memory_order_relaxed);
+    auto totalMicros = source.totalMicros.load(std::memory_order_relaxed);
+    auto maxMicros = source.maxMicros.load(std::memory_order_relaxed);
+    target.totalSeconds = double(totalMicros) / 1e6;
+    target.maxSeconds = double(maxMicros) / 1e6;
+  }
+  for (size_t o = 0; o < outcomeCount; o++)
+    snapshot.outcomes[o] = all.outcomes[o].load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+const char* ArtStats::stageName(Stage stage) {
+  switch (stage) {
+    case Stage::queueWait:
+      return "queue wait";
+    case Stage::open:
+      return "extractor open";
+    case Stage::query:
+      return "query";
+    case Stage::decode:
+      return "decode";
+    case Stage::resize:
+      return "resize";
+    case Stage::upload:
+      return "upload";
+    default:
+      return "?";
+  }
+}
+
+const char* ArtStats::outcomeName(Outcome outcome) {
+  switch (outcome) {
+    case Outcome::cached:
+      return "cached";
+    case Outcome::knownMissing:
+      return "known missing";
+    case Outcome::unchanged:
+      return "unchanged";
+    case Outcome::found:
+      return "found";
+    case Outcome::missing:
+      return "missing";
+    case Outcome::failed:
+      return "failed";
+    case Outcome::undecodable:
+      return "undecodable";
+    default:
+      return "?";
+  }
+}
+
+void ArtStats::dump() {
+  auto snapshot = getSnapshot();
+  std::ostringstream out;
+  out.flags(std::ios_base::fixed);
+  out.precision(3);
+  out << "Coverflow album art statistics\n";
+  for (size_t o = 0; o < outcomeCount; o++) {
+    out << (o > 0 ? ", " : "") << snapshot.outcomes[o] << " "
+        << outcomeName(Outcome(o));
+  }
+  out << "\n";
+  for (size_t s = 0; s < stageCount; s++) {
+    const Histogram& histogram = snapshot.stages[s];
+    out << stageName(Stage(s)) << ": " << histogram.count << " samples, mean "
+        << 1000 * histogram.mean() << " ms, p50 < " << 1000 * histogram.quantile(0.5)
+        << " ms, p95 < " << 1000 * histogram.quantile(0.95) << " ms, max "
+        << 1000 * histogram.maxSeconds << " ms\n";
+    for (int i = 0; i < bucketCount; i++) {
+      if (histogram.buckets[i] == 0)
+        continue;
+      out << "  " << (i + 1 < bucketCount ? "< " : ">= ") << std::setw(10)
+          << 1000 * bucketLimit(i + 1 < bucketCount ? i : i - 1) << " ms: "
+          << histogram.buckets[i] << "\n";
+    }
+  }
+  console::print(out.str().c_str());
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "utils.h"
+
+/// Timings and outcomes of album art loading.
+///
+/// Always on, so slow network shares and pathological embedded art can be diagnosed in
+/// release builds. Every stage records into a histogram with one bucket per power of
+/// two microseconds. Recording only touches a few relaxed atomics.
+class ArtStats {
+ public:
+  // Queue wait lasts until a fetch thread takes the request. Resize includes the
+  // mipmaps, upload is the copy into the texture atlas.
+  enum class Stage { queueWait, open, query, decode, resize, upload, count };
+  enum class Outcome {
+    // Served from the ThumbnailStore, including art shared with another album
+    cached,
+    // Skipped, as the ThumbnailStore knows the album has no art
+    knownMissing,
+    // The art source of a cached texture did not change, it stays in use
+    unchanged,
+    // Results of the album art extractor
+    found,
+    missing,
+    failed,
+    // Art that was found, but could not be decoded
+    undecodable,
+    count
+  };
+  static constexpr int bucketCount = 26;
+
+  static void record(Stage stage, double seconds);
+  static void count(Outcome outcome);
+  /// Starts over, e.g. before reproducing a problem
+  static void reset();
+
+  struct Histogram {
+    // Bucket i counts durations shorter than 2^i microseconds, but not shorter than
+    // 2^(i-1). The last bucket also counts everything longer.
+    std::array<uint64_t, bucketCount> buckets;
+    uint64_t count;
+    double totalSeconds;
+    double maxSeconds;
+
+    double mean() const;
+    /// Upper bound of the `fraction` quantile, in seconds
+    double quantile(double fraction) const;
+  };
+  struct Snapshot {
+    std::array<Histogram, size_t(Stage::count)> stages;
+    std::array<uint64_t, size_t(Outcome::count)> outcomes;
+
+    const Histogram& operator[](Stage stage) const { return stages[size_t(stage)]; }
+    uint64_t operator[](Outcome outcome) const { return outcomes[size_t(outcome)]; }
+  };
+  static Snapshot getSnapshot();
+
+  static const char* stageName(Stage stage);
+  static const char* outcomeName(Outcome outcome);
+  /// Writes the outcomes and all histograms to the console
+  static void dump();
+};
@@ -44,3 +44,80 @@ class BlockingQueue {
     return {std::move(rc)};
   }
 };
+
+/// Fixed-capacity FIFO connecting two pipeline stages.
+/// push() blocks while the queue is full, pop() blocks while it is empty.
+/// After close(), both return immediately and signal failure.
+template <typename T>
+class BoundedQueue {
+ private:
+  std::mutex d_mutex;
+  std::condition_variable d_notEmpty;
+  std::condition_variable d_notFull;
+  std::deque<T> d_queue;
+  size_t d_capacity;
+  bool d_closed = false;
+
+ public:
+  explicit BoundedQueue(size_t capacity) : d_capacity(capacity) {}
+
+  bool push(T&& value) {
+    {
+      std::unique_lock lock{this->d_mutex};
+      this->d_notFull.wait(lock, [=] {
+        return this->d_closed || this->d_queue.size() < this->d_capacity;
+      });
+      if (this->d_closed)
+        return false;
+      d_queue.push_back(std::move(value));
+    }
+    this->d_notEmpty.notify_one();
+    return true;
+  }
+  std::optional<T> pop() {
+    std::optional<T> rc;
+    {
+      std::unique_lock lock{this->d_mutex};
+      this->d_notEmpty.wait(
+          lock, [=] { return this->d_closed || !this->d_queue.empty(); });
+      if (this->d_closed)
+        return std::nullopt;
+      rc.emplace(std::move(this->d_queue.front()));
+      this->d_queue.pop_front();
+    }
+    this->d_notFull.notify_one();
+    return rc;
+  }
+  /// Like pop(), but also gives up after `timeout`. Use closed() to tell the two apart.
+  template <typename Duration>
+  std::optional<T> popFor(Duration timeout) {
+    std::optional<T> rc;
+    {
+      std::unique_lock lock{this->d_mutex};
+      bool ready = this->d_notEmpty.wait_for(
+          lock, timeout, [=] { return this->d_closed || !this->d_queue.empty(); });
+      if (!ready || this->d_closed)
+        return std::nullopt;
+      rc.emplace(std::move(this->d_queue.front()));
+      this->d_queue.pop_front();
+    }
+    this->d_notFull.notify_one();
+    return rc;
+  }
+  void close() {
+    {
+      std::scoped_lock lock{this->d_mutex};
+      this->d_closed = true;
+    }
+    this->d_notEmpty.notify_all();
+    this->d_notFull.notify_all();
+  }
+  size_t size() {
+    std::scoped_lock lock{this->d_mutex};
+    return this->d_queue.size();
+  }
+  bool closed() {
+    std::scoped_lock lock{this->d_mutex};
+    return this->d_closed;
+  }
+};
@@ -0,0 +1,253 @@
+#include "BufferPool.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+// Requests of up to 64 KB go to the heap, up to 64 MB are pooled
+constexpr int minShift = 16;
+constexpr int maxShift = 26;
+constexpr int stepsPerOctave = 4;
+constexpr int classCount = (maxShift - minShift) * stepsPerOctave + 1;
+constexpr int unpooled = -1;
+
+// Every loader thread has a cache, so these have to stay small. Larger buffers are
+// passed through the shared pool.
+constexpr size_t threadCacheDepth = 2;
+constexpr size_t threadCacheLimit = size_t{4} << 20;
+constexpr size_t sharedPoolLimit = size_t{128} << 20;
+
+constexpr uint32_t blockMagic = 0x4c4f4f50;  // "POOL", while the buffer is in use
+constexpr uint32_t freeMagic = 0x45455246;   // "FREE", while a pool holds it
+
+/// Precedes every buffer, keeps the buffer 16 byte aligned
+struct alignas(16) BlockHeader {
+  size_t capacity;
+  int32_t sizeClass;
+  uint32_t magic;
+};
+
+size_t classSize(int sizeClass) {
+  size_t base = size_t{1} << (minShift + sizeClass / stepsPerOctave);
+  return base + (sizeClass % stepsPerOctave) * (base / stepsPerOctave);
+}
+
+int sizeClassFor(size_t size) {
+  if (size <= (size_t{1} << minShift) || size > (size_t{1} << maxShift))
+    return unpooled;
+  int sizeClass = 0;
+  while (classSize(sizeClass) < size) sizeClass++;
+  return sizeClass;
+}
+
+/// The header of a buffer handed out by BufferPool, nullptr for buffers from the heap
+/// or from another allocator
+BlockHeader* headerOf(void* buffer) {
+  auto* header = static_cast<BlockHeader*>(buffer) - 1;
+  return header->magic == blockMagic ? header : nullptr;
+}
+
+/// Whether `buffer` was already returned to a pool
+bool isReleased(void* buffer) {
+  return (static_cast<BlockHeader*>(buffer) - 1)->magic == freeMagic;
+}
+
+void* bufferOf(BlockHeader* header) {
+  header->magic = blockMagic;
+  return header + 1;
+}
+
+struct Counters {
+  std::atomic<uint64_t> requests = 0;
+  std::atomic<uint64_t> threadHits = 0;
+  std::atomic<uint64_t> sharedHits = 0;
+};
+
+struct SharedPool {
+  std::mutex mutex;
+  std::array<std::vector<BlockHeader*>, classCount> free;
+  size_t bytes = 0;
+  Counters counters;
+  // Incremented by BufferPool::trim(). Thread caches of an older generation free their
+  // buffers before they are used again.
+  std::atomic<uint32_t> generation = 0;
+
+  void trim() {
+    std::scoped_lock lock{mutex};
+    for (auto& blocks : free) {
+      // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+      for (auto* block : blocks) std::free(block);
+      blocks.clear();
+    }
+    bytes = 0;
+  }
+};
+
+SharedPool& sharedPool() {
+  // Never destroyed, thread caches might still return buffers during shutdown
+  static auto* pool = new SharedPool();
+  return *pool;
+}
+
+/// Returns `block` to the shared pool, or to the heap if the pool is full
+void releaseShared(BlockHeader* block) {
+  auto& pool = sharedPool();
+  {
+    std::scoped_lock lock{pool.mutex};
+    if (pool.bytes + block->capacity <= sharedPoolLimit) {
+      block->magic = freeMagic;
+      pool.free[block->sizeClass].push_back(block);
+      pool.bytes += block->capacity;
+      return;
+    }
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  std::free(block);
+}
+
+struct ThreadCache {
+  std::array<std::vector<BlockHeader*>, classCount> free;
+  size_t bytes = 0;
+  uint32_t generation = 0;
+
+  ThreadCache() = default;
+  ThreadCache(const ThreadCache&) = delete;
+  ThreadCache& operator=(const ThreadCache&) = delete;
+  ~ThreadCache() { clear(false); }
+
+  /// Returns all buffers to the shared pool, or to the heap if `toHeap`
+  void clear(bool toHeap) {
+    for (auto& blocks : free) {
+      for (auto* block : blocks) {
+        if (toHeap) {
+          // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+          std::free(block);
+        } else {
+          releaseShared(block);
+        }
+      }
+      blocks.clear();
+    }
+    bytes = 0;
+  }
+};
+thread_local ThreadCache threadCacheStorage;
+
+/// The cache of the calling thread, emptied first if the pool was trimmed since the
+/// thread last used it
+ThreadCache& threadCache() {
+  uint32_t generation = sharedPool().generation.load(std::memory_order_relaxed);
+  if (threadCacheStorage.generation != generation) {
+    threadCacheStorage.clear(true);
+    threadCacheStorage.generation = generation;
+  }
+  return threadCacheStorage;
+}
+}  // namespace
+
+void* BufferPool::allocate(size_t size) {
+  auto& pool = sharedPool();
+  int sizeClass = sizeClassFor(size);
+  if (sizeClass != unpooled) {
+    pool.counters.requests.fetch_add(1, std::memory_order_relaxed);
+    ThreadCache& cache = threadCache();
+    auto& local = cache.free[sizeClass];
+    if (!local.empty()) {
+      BlockHeader* block = local.back();
+      local.pop_back();
+      cache.bytes -= block->capacity;
+      pool.counters.threadHits.fetch_add(1, std::memory_order_relaxed);
+      return bufferOf(block);
+    }
+    std::unique_lock lock{pool.mutex};
+    auto& shared = pool.free[sizeClass];
+    if (!shared.empty()) {
+      BlockHeader* block = shared.back();
+      shared.pop_back();
+      pool.bytes -= block->capacity;
+      lock.unlock();
+      pool.counters.sharedHits.fetch_add(1, std::memory_order_relaxed);
+      return bufferOf(block);
+    }
+  }
+
+  size_t capacity = sizeClass != unpooled ? classSize(sizeClass) : size;
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  auto* block = static_cast<BlockHeader*>(std::malloc(sizeof(BlockHeader) + capacity));
+  if (block == nullptr)
+    return nullptr;
+  *block = BlockHeader{capacity, sizeClass, blockMagic};
+  return bufferOf(block);
+}
+
+void* BufferPool::reallocate(void* buffer, size_t size) {
+  if (buffer == nullptr)
+    return allocate(size);
+  BlockHeader* block = headerOf(buffer);
+  if (block == nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    return std::realloc(buffer, size);
+  }
+  size_t capacity = block->capacity;
+  if (size <= capacity)
+    return buffer;
+  void* grown = allocate(size);
+  if (grown == nullptr)
+    return nullptr;
+  std::memcpy(grown, buffer, capacity);
+  release(buffer);
+  return grown;
+}
+
+void BufferPool::release(void* buffer) {
+  if (buffer == nullptr || isReleased(buffer))
+    return;
+  BlockHeader* block = headerOf(buffer);
+  if (block == nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    std::free(buffer);
+    return;
+  }
+  if (block->sizeClass == unpooled) {
+    block->magic = 0;
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    std::free(block);
+    return;
+  }
+  ThreadCache& cache = threadCache();
+  auto& local = cache.free[block->sizeClass];
+  if (local.size() < threadCacheDepth &&
+      cache.bytes + block->capacity <= threadCacheLimit) {
+    block->magic = freeMagic;
+    local.push_back(block);
+    cache.bytes += block->capacity;
+    return;
+  }
+  releaseShared(block);
+}
+
+void BufferPool::releaseThreadCache() {
+  threadCache().clear(false);
+}
+
+void BufferPool::trim() {
+  auto& pool = sharedPool();
+  pool.generation.fetch_add(1, std::memory_order_relaxed);
+  pool.trim();
+}
+
+BufferPool::Stats BufferPool::getStats() {
+  auto& pool = sharedPool();
+  size_t pooledBytes = 0;
+  {
+    std::scoped_lock lock{pool.mutex};
+    pooledBytes = pool.bytes;
+  }
+  return Stats{pool.counters.requests.load(std::memory_order_relaxed),
+               pool.counters.threadHits.load(std::memory_order_relaxed),
+               pool.counters.sharedHits.load(std::memory_order_relaxed), pooledBytes};
+}
@@ -0,0 +1,49 @@
+#pragma once
+// This file does not depend on foobar2000 or Windows, so it can be built standalone.
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Size-classed pool for large pixel buffers.
+///
+/// The loader threads allocate and free multi-megabyte buffers for every cover: art
+/// decoded by stb_image or WIC, resized images, mip levels and BC1 blocks. Serving
+/// these from the heap causes lock contention and fragments the address space.
+///
+/// Requests are rounded up to one of four size classes per power of two. Each thread
+/// keeps a few free buffers of up to a few MB per class. Behind these is a shared pool,
+/// which also takes the buffers that one thread allocates and another one frees, as in
+/// the fetch -> decode -> resize -> upload pipeline. Small requests bypass the pool.
+class BufferPool {
+ public:
+  /// Like malloc, returns nullptr on failure
+  static void* allocate(size_t size);
+  /// Like realloc. Grows in place if the size class has room.
+  static void* reallocate(void* buffer, size_t size);
+  /// Like free, for buffers from allocate() and reallocate(). Buffers from the heap are
+  /// passed on to free, buffers that were already released are ignored.
+  static void release(void* buffer);
+  /// Returns the free buffers of the calling thread to the shared pool. Call when a
+  /// thread goes idle or exits.
+  static void releaseThreadCache();
+  /// Frees the buffers held by the shared pool. Each thread frees its own buffers the
+  /// next time it uses the pool.
+  static void trim();
+
+  struct Release {
+    void operator()(void* buffer) const { release(buffer); }
+  };
+
+  struct Stats {
+    // Requests large enough for the pool, and how many of them it served
+    uint64_t requests;
+    uint64_t threadHits;
+    uint64_t sharedHits;
+    // Free buffers held by the shared pool
+    size_t pooledBytes;
+  };
+  static Stats getStats();
+};
+
+/// Owns a buffer from BufferPool
+using PooledBuffer = std::unique_ptr<void, BufferPool::Release>;
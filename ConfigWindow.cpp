@@ -13,6 +13,7 @@
 #include "PlaybackTracer.h"
 #include "config.h"
 #include "cover_positions_compiler.h"
+#include "image_kernels.h"
 #include "utils.h"
 
 namespace {
@@ -63,6 +64,8 @@ std::unordered_map<UINT, cfg_bool*> boolVarMap{
     // Performance
     {IDC_MULTI_SAMPLING, &cfgMultisampling},
     {IDC_TEXTURE_COMPRESSION, &cfgTextureCompression},
+    {IDC_PROGRESSIVE_LOADING, &cfgProgressiveLoading},
+    {IDC_RESIZE_SRGB, &cfgResizeSrgb},
     {IDC_EMPTY_ON_MINIMIZE, &cfgEmptyCacheOnMinimize},
     {IDC_SHOW_FPS, &cfgShowFps},
 };
@@ -84,6 +87,8 @@ std::multimap<UINT, int> disableMap{
 
     // Performance
     {IDC_MULTI_SAMPLING, IDC_MULTI_SAMPLING_PASSES},
+    {IDC_PROGRESSIVE_LOADING, IDC_FULL_RES_DISTANCE},
+    {IDC_PROGRESSIVE_LOADING, IDC_FULL_RES_DISTANCE_SPIN},
 };
 
 class ConfigTab {
@@ -822,6 +827,12 @@ ListMap multisamplingMap{
     {16, "16"},
 };
 
+ListMap resizeFilterMap{
+    {int(image_kernels::ResizeFilter::box), "Box"},
+    {int(image_kernels::ResizeFilter::bilinear), "Bilinear"},
+    {int(image_kernels::ResizeFilter::lanczos3), "Lanczos"},
+};
+
 static struct {
   int id;
   cfg_int* var;
@@ -829,6 +840,7 @@ static struct {
   // NOLINTNEXTLINE(cppcoreguidelines-interfaces-global-init)
 } mappedListVarMap[] = {
     {IDC_MULTI_SAMPLING_PASSES, &cfgMultisamplingPasses, multisamplingMap},
+    {IDC_RESIZE_FILTER, &cfgResizeFilter, resizeFilterMap},
 };
 
 class PerformanceTab : public ConfigTab {
@@ -840,12 +852,21 @@ class PerformanceTab : public ConfigTab {
         loadConfig();
         fillComboBoxes();
 
-        SendDlgItemMessage(hWnd, IDC_CACHE_SIZE_SPIN, UDM_SETRANGE32, 2, 999);
-        SetDlgItemInt(hWnd, IDC_CACHE_SIZE, cfgTextureCacheSize, 1);
+        SendDlgItemMessage(hWnd, IDC_CACHE_SIZE_SPIN, UDM_SETRANGE32, 16, 4096);
+        SetDlgItemInt(hWnd, IDC_CACHE_SIZE, cfgTextureMemory, 1);
 
         SendDlgItemMessage(hWnd, IDC_TEXTURE_SIZE_SPIN, UDM_SETRANGE32, 4, 2024);
         SetDlgItemInt(hWnd, IDC_TEXTURE_SIZE, cfgMaxTextureSize, 1);
 
+        SendDlgItemMessage(hWnd, IDC_FULL_RES_DISTANCE_SPIN, UDM_SETRANGE32, 0, 999);
+        SetDlgItemInt(hWnd, IDC_FULL_RES_DISTANCE, cfgFullResDistance, 1);
+
+        SendDlgItemMessage(hWnd, IDC_UPLOAD_BUDGET_SPIN, UDM_SETRANGE32, 1, 100);
+        SetDlgItemInt(hWnd, IDC_UPLOAD_BUDGET, cfgUploadBudget, 1);
+
+        SendDlgItemMessage(hWnd, IDC_MIN_DWELL_TIME_SPIN, UDM_SETRANGE32, 0, 999);
+        SetDlgItemInt(hWnd, IDC_MIN_DWELL_TIME, cfgMinDwellTime, 1);
+
         switch (cfgVSyncMode) {
           case VSYNC_SLEEP_ONLY:
             uButton_SetCheck(hWnd, IDC_VSYNC_OFF, true);
@@ -864,11 +885,20 @@ class PerformanceTab : public ConfigTab {
           textChanged(LOWORD(wParam));
 
           if (LOWORD(wParam) == IDC_CACHE_SIZE) {
-            cfgTextureCacheSize =
-                std::clamp(int(uGetDlgItemInt(hWnd, IDC_CACHE_SIZE, nullptr, 1)), 2, 999);
+            cfgTextureMemory = std::clamp(
+                int(uGetDlgItemInt(hWnd, IDC_CACHE_SIZE, nullptr, 1)), 16, 4096);
           } else if (LOWORD(wParam) == IDC_TEXTURE_SIZE) {
             cfgMaxTextureSize = std::clamp(
                 int(uGetDlgItemInt(hWnd, IDC_TEXTURE_SIZE, nullptr, 1)), 4, 2024);
+          } else if (LOWORD(wParam) == IDC_FULL_RES_DISTANCE) {
+            cfgFullResDistance = std::clamp(
+                int(uGetDlgItemInt(hWnd, IDC_FULL_RES_DISTANCE, nullptr, 1)), 0, 999);
+          } else if (LOWORD(wParam) == IDC_UPLOAD_BUDGET) {
+            cfgUploadBudget = std::clamp(
+                int(uGetDlgItemInt(hWnd, IDC_UPLOAD_BUDGET, nullptr, 1)), 1, 100);
+          } else if (LOWORD(wParam) == IDC_MIN_DWELL_TIME) {
+            cfgMinDwellTime = std::clamp(
+                int(uGetDlgItemInt(hWnd, IDC_MIN_DWELL_TIME, nullptr, 1)), 0, 999);
           }
         } else if (HIWORD(wParam) == BN_CLICKED) {
           buttonClicked(LOWORD(wParam));
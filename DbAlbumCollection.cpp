@@ -6,44 +6,361 @@
 #include "FindAsYouType.h"
 #include "config.h"
 
+namespace {
+// Smaller batches are not worth starting threads for
+constexpr t_size minShardSize = 4096;
+
+/// Upper limit of the shards of DBWriter::runSharded
+t_size maxShardCount() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+}  // namespace
+
 namespace db_structure {
 
-DB::DB(t_uint64 libraryVersion, const std::string& filterQuery,
-       const std::string& keyFormat, const std::string& sortFormat,
-       const std::string& titleFormat)
+DB::DB(t_uint64 libraryVersion, Settings settings)
     : keyIndex(container.get<key>()), sortIndex(container.get<sortKey>()),
-      libraryVersion(libraryVersion) {
-  if (!filterQuery.empty()) {
+      libraryVersion(libraryVersion), settings(std::move(settings)) {
+  if (!this->settings.filterQuery.empty()) {
     try {
-      filter ^= search_filter_manager::get()->create(filterQuery.c_str());
+      auto filterManager = search_filter_manager::get();
+      filter ^= filterManager->create(this->settings.filterQuery.c_str());
+      shardFilters.resize(maxShardCount());
+      for (auto& shardFilter : shardFilters) {
+        shardFilter ^= filterManager->create(this->settings.filterQuery.c_str());
+      }
     } catch (pfc::exception&) {
+      filter.release();
+      shardFilters.clear();
     };
   }
-  titleformat_compiler::get()->compile_safe_ex(keyBuilder, keyFormat.c_str());
-  titleformat_compiler::get()->compile_safe_ex(titleFormatter, titleFormat.c_str());
-  if (!sortFormat.empty())
-    titleformat_compiler::get()->compile_safe(sortFormatter, sortFormat.c_str());
+  auto compiler = titleformat_compiler::get();
+  compiler->compile_safe_ex(keyBuilder, this->settings.keyFormat.c_str());
+  compiler->compile_safe_ex(titleFormatter, this->settings.titleFormat.c_str());
+  if (!this->settings.sortFormat.empty())
+    compiler->compile_safe(sortFormatter, this->settings.sortFormat.c_str());
+}
+
+namespace {
+// The map grows once more than 7/10 of its slots are used
+constexpr size_t maxLoadPercent = 70;
+constexpr size_t minCapacity = 64;
+}  // namespace
+
+size_t TrackMap::home(const metadb_handle* track) const {
+  // Fibonacci hashing, the low bits of heap pointers carry little information
+  return size_t((t_uint64(reinterpret_cast<uintptr_t>(track)) * 0x9E3779B97F4A7C15ull) >>
+                shift);
+}
+
+size_t TrackMap::findSlot(const metadb_handle* track) const {
+  size_t mask = slots.size() - 1;
+  size_t i = home(track);
+  while (slots[i].track != nullptr && slots[i].track != track) i = (i + 1) & mask;
+  return i;
+}
+
+const Album* TrackMap::find(const metadb_handle_ptr& track) const {
+  if (count == 0)
+    return nullptr;
+  return slots[findSlot(track.get_ptr())].album;
+}
+
+void TrackMap::insert(const metadb_handle_ptr& track, const Album& album) {
+  reserve(count + 1);
+  Slot& slot = slots[findSlot(track.get_ptr())];
+  if (slot.track != nullptr)
+    return;
+  slot = Slot{track.get_ptr(), &album};
+  count++;
+}
+
+void TrackMap::erase(const metadb_handle_ptr& track) {
+  if (count == 0)
+    return;
+  size_t mask = slots.size() - 1;
+  size_t hole = findSlot(track.get_ptr());
+  if (slots[hole].track == nullptr)
+    return;
+  count--;
+  // Moves the later slots of the probe sequence into the hole where possible, so that
+  // lookups don't need tombstones
+  for (size_t i = (hole + 1) & mask; slots[i].track != nullptr; i = (i + 1) & mask) {
+    size_t want = home(slots[i].track);
+    if (((i - hole) & mask) <= ((i - want) & mask)) {
+      slots[hole] = slots[i];
+      hole = i;
+    }
+  }
+  slots[hole] = Slot{};
+}
+
+void TrackMap::clear() {
+  slots.clear();
+  count = 0;
+  shift = 64;
+}
+
+void TrackMap::reserve(size_t wanted) {
+  size_t capacity = std::max(slots.size(), minCapacity);
+  while (wanted * 100 > capacity * maxLoadPercent) capacity *= 2;
+  if (capacity != slots.size())
+    rehash(capacity);
+}
+
+void TrackMap::rehash(size_t capacity) {
+  std::vector<Slot> old(capacity, Slot{});
+  std::swap(old, slots);
+  shift = 64;
+  for (size_t c = capacity; c > 1; c >>= 1) shift--;
+  for (const Slot& slot : old) {
+    if (slot.track != nullptr)
+      slots[findSlot(slot.track)] = slot;
+  }
 }
 
 }  // namespace db_structure
 
+template <typename Fn>
+auto DBWriter::runSharded(t_size count, Fn&& fn) {
+  using Result = decltype(fn(t_size{}, t_size{}, db.filter));
+  std::vector<Result> results;
+  t_size shardCount = std::clamp<t_size>(count / minShardSize, 1, maxShardCount());
+  if (shardCount == 1) {
+    results.push_back(fn(0, count, db.filter));
+    return results;
+  }
+  int priority = GetThreadPriority(GetCurrentThread());
+  std::vector<std::future<Result>> shards;
+  for (t_size i = 0; i < shardCount; i++) {
+    t_size begin = count * i / shardCount;
+    t_size end = count * (i + 1) / shardCount;
+    shards.push_back(std::async(std::launch::async, [&, i, begin, end] {
+      SetThreadPriority(GetCurrentThread(), priority);
+      return fn(begin, end, db.filter.is_valid() ? db.shardFilters[i] : db.filter);
+    }));
+  }
+  for (auto& shard : shards) {
+    results.push_back(shard.get());
+  }
+  return results;
+}
+
 void DBWriter::add_tracks(metadb_handle_list_cref tracks, abort_callback& abort) {
-  pfc::array_t<bool> filterMask;
-  filterMask.set_size(tracks.get_count());
-  if (db.filter.is_valid()) {
-    db.filter->test_multi_ex(tracks, filterMask.get_ptr(), abort);
-  } else {
-    filterMask.fill(true);
+  // Shards are contiguous and merged in order, so albums get their tracks, sort key
+  // and title in the same order as when adding the tracks one by one
+  auto shards = runSharded(tracks.get_count(), [&](t_size begin, t_size end,
+                                                   const search_filter_v2::ptr& filter) {
+    return buildShard(tracks, begin, end, filter, abort);
+  });
+  size_t added = 0;
+  for (const auto& shard : shards) {
+    for (const auto& album : shard) added += album.tracks.get_count();
+  }
+  db.trackMap.reserve(db.trackMap.size() + added);
+  for (auto& shard : shards) {
+    mergeShard(std::move(shard));
+  }
+}
+
+void DBWriter::add_albums(std::vector<db_structure::AlbumData>&& albums,
+                          const db_structure::Settings& previous,
+                          metadb_handle_list_cref library, metadb_handle_list_cref stale,
+                          abort_callback& abort) {
+  PFC_ASSERT(previous.keyFormat == db.settings.keyFormat);
+  bool refilter = previous.filterQuery != db.settings.filterQuery;
+  bool resort = previous.sortFormat != db.settings.sortFormat;
+  bool retitle = previous.titleFormat != db.settings.titleFormat;
+
+  // A full build adds the tracks in library order. That is the order of the tracks
+  // within each album, and of the albums by their first track.
+  std::unordered_map<const metadb_handle*, t_size> libraryOrder;
+  libraryOrder.reserve(library.get_count());
+  for (t_size i = 0; i < library.get_count(); i++) {
+    libraryOrder.emplace(library[i].get_ptr(), i);
+  }
+  auto position = [&](const metadb_handle_ptr& track) {
+    return libraryOrder.at(track.get_ptr());
+  };
+  // Stale tracks leave their albums and are added again like new ones
+  std::vector<bool> isStale(library.get_count(), false);
+  for (const auto& track : stale) {
+    auto entry = libraryOrder.find(track.get_ptr());
+    if (entry != libraryOrder.end())
+      isStale[entry->second] = true;
+  }
+
+  // With a new filter, albums keep the tracks that still pass, and the tracks that pass
+  // now are added like new ones
+  std::vector<bool> passing;
+  std::vector<bool> present(library.get_count(), false);
+  if (refilter) {
+    for (const auto& album : albums) {
+      for (const auto& track : album.tracks) {
+        auto entry = libraryOrder.find(track.get_ptr());
+        if (entry != libraryOrder.end())
+          present[entry->second] = true;
+      }
+    }
+    auto masks = runSharded(
+        library.get_count(),
+        [&](t_size begin, t_size end, const search_filter_v2::ptr& filter) {
+          return filterShard(library, begin, end, filter, abort);
+        });
+    passing.reserve(library.get_count());
+    for (const auto& mask : masks) {
+      passing.insert(passing.end(), mask.begin(), mask.end());
+    }
+  }
+  metadb_handle_list added;
+  for (t_size i = 0; i < library.get_count(); i++) {
+    if (refilter ? passing[i] && (!present[i] || isStale[i]) : isStale[i])
+      added.add_item(library[i]);
   }
   abort.check();
 
-  for (t_size i = 0; i < tracks.get_size(); i++) {
-    if (!filterMask[i])
+  // The albums by key, and the track their sort key and title were formatted from
+  std::unordered_map<std::string, size_t> albumIndex;
+  std::vector<metadb_handle_ptr> formattedFrom;
+  std::vector<db_structure::AlbumData> previousAlbums;
+  std::swap(previousAlbums, albums);
+  for (auto& album : previousAlbums) {
+    metadb_handle_list kept;
+    for (const auto& track : album.tracks) {
+      auto entry = libraryOrder.find(track.get_ptr());
+      if (entry != libraryOrder.end() && !isStale[entry->second] &&
+          (!refilter || passing[entry->second]))
+        kept.add_item(track);
+    }
+    if (kept.get_count() == 0)
+      continue;
+    formattedFrom.push_back(album.tracks[0]);
+    album.tracks = std::move(kept);
+    albumIndex.emplace(album.key, albums.size());
+    albums.push_back(std::move(album));
+  }
+
+  // The added tracks are grouped into albums like in add_tracks, then merged with the
+  // albums they belong to
+  auto shards = runSharded(added.get_count(), [&](t_size begin, t_size end,
+                                                  const search_filter_v2::ptr& filter) {
+    return buildShard(added, begin, end, filter, abort);
+  });
+  for (auto& shard : shards) {
+    for (auto& partial : shard) {
+      auto [entry, isNew] = albumIndex.try_emplace(partial.key, albums.size());
+      if (isNew) {
+        formattedFrom.push_back(partial.tracks[0]);
+        albums.push_back(std::move(partial));
+      } else {
+        albums[entry->second].tracks.add_items(partial.tracks);
+      }
+    }
+  }
+  abort.check();
+
+  size_t trackCount = 0;
+  for (size_t i = 0; i < albums.size(); i++) {
+    auto& album = albums[i];
+    album.tracks.sort_t([&](const metadb_handle_ptr& a, const metadb_handle_ptr& b) {
+      return pfc::compare_t(position(a), position(b));
+    });
+    trackCount += album.tracks.get_count();
+    const metadb_handle_ptr& track = album.tracks[0];
+    bool newFirst = track != formattedFrom[i] || isStale[position(track)];
+    if (resort || newFirst) {
+      if (db.sortFormatter.is_valid()) {
+        track->format_title(nullptr, sortBuffer, db.sortFormatter, nullptr);
+        sortBufferWide.convert(sortBuffer);
+      } else {
+        sortBufferWide.convert(album.key.c_str());
+      }
+      album.sortKey = sortBufferWide.get_ptr();
+    }
+    if (retitle || newFirst) {
+      track->format_title(nullptr, titleBuffer, db.titleFormatter, nullptr);
+      album.title = titleBuffer.get_ptr();
+    }
+  }
+  abort.check();
+
+  // Albums with equal sort keys stay in the order they are inserted in
+  std::sort(albums.begin(), albums.end(), [&](const auto& a, const auto& b) {
+    return position(a.tracks[0]) < position(b.tracks[0]);
+  });
+  db.trackMap.reserve(trackCount);
+  for (auto& album : albums) {
+    auto [entry, isNew] = db.container.emplace(album.key.c_str(), album.sortKey.c_str(),
+                                               album.title.c_str());
+    PFC_ASSERT(isNew);
+    entry->tracks = std::move(album.tracks);
+    for (const auto& albumTrack : entry->tracks) {
+      db.trackMap.insert(albumTrack, *entry);
+    }
+  }
+}
+
+std::vector<bool> DBWriter::filterShard(metadb_handle_list_cref tracks, t_size begin,
+                                        t_size end, const search_filter_v2::ptr& filter,
+                                        abort_callback& abort) const {
+  if (!filter.is_valid())
+    return std::vector<bool>(end - begin, true);
+  metadb_handle_list range;
+  range.prealloc(end - begin);
+  for (t_size i = begin; i < end; i++) range.add_item(tracks[i]);
+  pfc::array_t<bool> filterMask;
+  filterMask.set_size(range.get_count());
+  filter->test_multi_ex(range, filterMask.get_ptr(), abort);
+  abort.check();
+  return std::vector<bool>(filterMask.get_ptr(), filterMask.get_ptr() + end - begin);
+}
+
+DBWriter::Shard DBWriter::buildShard(metadb_handle_list_cref tracks, t_size begin,
+                                     t_size end, const search_filter_v2::ptr& filter,
+                                     abort_callback& abort) const {
+  std::vector<bool> filterMask = filterShard(tracks, begin, end, filter, abort);
+  pfc::string8_fast_aggressive keyBuffer;
+  pfc::string8_fast_aggressive sortBuffer;
+  pfc::string8_fast_aggressive titleBuffer;
+  pfc::stringcvt::string_wide_from_utf8_fast sortBufferWide;
+  Shard shard;
+  std::unordered_map<std::string, size_t> albumIndex;
+  for (t_size i = begin; i < end; i++) {
+    if (!filterMask[i - begin])
       continue;
     abort.check();
 
     const metadb_handle_ptr& track = tracks[i];
-    add_track(track);
+    track->format_title(nullptr, keyBuffer, db.keyBuilder, nullptr);
+    auto [album, isNew] = albumIndex.try_emplace(keyBuffer.get_ptr(), shard.size());
+    if (isNew) {
+      if (db.sortFormatter.is_valid()) {
+        track->format_title(nullptr, sortBuffer, db.sortFormatter, nullptr);
+        sortBufferWide.convert(sortBuffer);
+      } else {
+        sortBufferWide.convert(keyBuffer);
+      }
+      track->format_title(nullptr, titleBuffer, db.titleFormatter, nullptr);
+      shard.push_back(db_structure::AlbumData{album->first, sortBufferWide.get_ptr(),
+                                              titleBuffer.get_ptr(), {}});
+    }
+    shard[album->second].tracks.add_item(track);
+  }
+  return shard;
+}
+
+void DBWriter::mergeShard(Shard&& shard) {
+  for (auto& partial : shard) {
+    auto album = db.keyIndex.find(partial.key);
+    if (album == db.keyIndex.end()) {
+      std::tie(album, std::ignore) = db.container.emplace(
+          partial.key.c_str(), partial.sortKey.c_str(), partial.title.c_str());
+    }
+    album->tracks.add_items(partial.tracks);
+    album->sortedTracks.reset();
+    for (const auto& track : partial.tracks) {
+      db.trackMap.insert(track, *album);
+    }
   }
 }
 
@@ -58,8 +375,8 @@ void DBWriter::modify_tracks(metadb_handle_list_cref tracks) {
   for (t_size i = 0; i < tracks.get_size(); i++) {
     const metadb_handle_ptr& track = tracks[i];
     bool want = filterMask[i];
-    auto kv = db.trackMap.find(track);
-    bool didContain = kv != db.trackMap.end();
+    const db_structure::Album* album = db.trackMap.find(track);
+    bool didContain = album != nullptr;
     if (!didContain && !want) {
       continue;
     } else if (!didContain && want) {
@@ -67,14 +384,15 @@ void DBWriter::modify_tracks(metadb_handle_list_cref tracks) {
     } else if (didContain && !want) {
       remove_track(track);
     } else {  // didContain && want
-      auto& album = kv->second;
       track->format_title(nullptr, keyBuffer, db.keyBuilder, nullptr);
-      if (album.key != keyBuffer.c_str()) {
+      if (album->key != keyBuffer.c_str()) {
         remove_track(track);
         add_track(track);
       } else {
-        if (album.tracks.find_item(track) == 0) {
-          update_album_metadata(album);
+        // The track's position within the album might have changed
+        album->sortedTracks.reset();
+        if (album->tracks.find_item(track) == 0) {
+          update_album_metadata(*album);
         }
       }
     }
@@ -96,20 +414,22 @@ void DBWriter::add_track(const metadb_handle_ptr& track) {
         db.container.emplace(keyBuffer, sortBufferWide, titleBuffer);
   }
   album->tracks.add_item(track);
-  db.trackMap.emplace(track, std::ref(*album));
+  album->sortedTracks.reset();
+  db.trackMap.insert(track, *album);
 }
 
 void DBWriter::remove_track(const metadb_handle_ptr& track) {
-  auto kv = db.trackMap.find(track);
-  if (kv == db.trackMap.end())
+  const db_structure::Album* found = db.trackMap.find(track);
+  if (found == nullptr)
     return;
-  auto& album = kv->second;
-  db.trackMap.erase(kv);
+  auto& album = *found;
+  db.trackMap.erase(track);
   if (album.tracks.get_size() == 1) {
     db.container.erase(db.container.iterator_to(album));
   } else {
     t_size track_index = album.tracks.find_item(track);
     album.tracks.remove_by_idx(track_index);
+    album.sortedTracks.reset();
     if (track_index == 0) {
       update_album_metadata(album);
     }
@@ -142,6 +462,7 @@ void DBWriter::remove_tracks(metadb_handle_list_cref tracks) {
 
 void DbAlbumCollection::onCollectionReload(std::unique_ptr<db_structure::DB> newDb) {
   db = std::move(newDb);
+  dbVersion++;
 
   decltype(libraryChangeQueue) changeQueue;
   std::swap(changeQueue, libraryChangeQueue);
@@ -150,18 +471,40 @@ void DbAlbumCollection::onCollectionReload(std::unique_ptr<db_structure::DB> new
   }
 }
 
-void DbAlbumCollection::getTracks(DBIter pos, metadb_handle_list& out) {
-  out = pos->tracks;
-  out.sort_by_format(cfgInnerSort, nullptr);
+std::shared_ptr<const metadb_handle_list> DbAlbumCollection::getTracks(DBIter pos) {
+  if (!innerSortScript.is_valid() || innerSort != cfgInnerSort.get_ptr()) {
+    innerSort = cfgInnerSort.get_ptr();
+    titleformat_compiler::get()->compile_safe(innerSortScript, innerSort.c_str());
+    for (const auto& album : db->container) {
+      album.sortedTracks.reset();
+    }
+  }
+  if (!pos->sortedTracks) {
+    auto sorted = std::make_shared<metadb_handle_list>(pos->tracks);
+    sorted->sort_by_format(innerSortScript, nullptr);
+    pos->sortedTracks = std::move(sorted);
+  }
+  return pos->sortedTracks;
+}
+
+std::vector<db_structure::AlbumData> DbAlbumCollection::copyAlbums() const {
+  std::vector<db_structure::AlbumData> albums;
+  if (!db)
+    return albums;
+  albums.reserve(db->container.size());
+  for (const auto& album : db->sortIndex) {
+    albums.push_back({album.key, album.sortKey, album.title, album.tracks});
+  }
+  return albums;
 }
 
 std::optional<DBPos> DbAlbumCollection::getPosForTrack(const metadb_handle_ptr& track) {
   if (!db)
     return std::nullopt;
-  auto kv = db->trackMap.find(track);
-  if (kv == db->trackMap.end())
+  const db_structure::Album* album = db->trackMap.find(track);
+  if (album == nullptr)
     return std::nullopt;
-  return posFromIter(db->keyIndex.iterator_to(kv->second));
+  return posFromIter(db->keyIndex.iterator_to(*album));
 }
 
 std::optional<DBIter> DbAlbumCollection::iterFromPos(const DBPos& p) const {
@@ -179,9 +522,7 @@ std::optional<DBIter> DbAlbumCollection::iterFromPos(const DBPos& p) const {
 }
 
 AlbumInfo DbAlbumCollection::getAlbumInfo(DBIter pos) {
-  metadb_handle_list tracks;
-  getTracks(pos, tracks);
-  return AlbumInfo{pos->title, posFromIter(pos), tracks};
+  return AlbumInfo{pos->title, posFromIter(pos), getTracks(pos)};
 }
 
 std::optional<DBPos> DbAlbumCollection::performFayt(const std::string& input) {
@@ -240,6 +581,7 @@ void DbAlbumCollection::handleLibraryChange(t_uint64 version, LibraryChangeType
   }
   if (version < db->libraryVersion)
     return;
+  dbVersion++;
   DBWriter writer(*db);
   if (type == items_added) {
     abort_callback_dummy aborter{};
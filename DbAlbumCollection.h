@@ -17,7 +17,8 @@ inline bool operator!=(const DBPos& lhs, const DBPos& rhs) {
 struct AlbumInfo {
   std::string title;
   DBPos pos;
-  metadb_handle_list tracks;
+  // Sorted by cfgInnerSort, shared with the album's cache
+  std::shared_ptr<const metadb_handle_list> tracks;
 };
 
 namespace db_structure {
@@ -32,6 +33,23 @@ struct CompWLogical {
 struct key {};
 struct sortKey {};
 
+/// The settings a DB is built with
+struct Settings {
+  // Empty if there is no filter
+  std::string filterQuery;
+  std::string keyFormat;
+  // Empty to sort by key
+  std::string sortFormat;
+  std::string titleFormat;
+
+  bool operator==(const Settings& other) const {
+    return std::tie(filterQuery, keyFormat, sortFormat, titleFormat) ==
+           std::tie(other.filterQuery, other.keyFormat, other.sortFormat,
+                    other.titleFormat);
+  }
+  bool operator!=(const Settings& other) const { return !(*this == other); }
+};
+
 struct Album {
   Album(const char* key, const wchar_t* sortKey, const char* title)
       : key(key), sortKey(sortKey), title(title){};
@@ -42,6 +60,54 @@ struct Album {
   std::wstring sortKey;
   std::string title;
   mutable metadb_handle_list tracks;
+  // `tracks` sorted by cfgInnerSort, built on first use. Reset whenever the tracks
+  // change, see DBWriter.
+  mutable std::shared_ptr<const metadb_handle_list> sortedTracks;
+};
+
+/// An album outside of a DB, e.g. while a DB is built
+struct AlbumData {
+  std::string key;
+  std::wstring sortKey;
+  std::string title;
+  metadb_handle_list tracks;
+};
+
+/// Maps tracks to their albums, open addressing with linear probing.
+///
+/// Keyed by the handle pointer without holding a reference, as the album's track list
+/// keeps the handle alive. One slot is two pointers, so at the usual load factor this
+/// takes a fraction of the memory of a tree node per track, and a lookup mostly touches
+/// a single cache line.
+class TrackMap {
+ public:
+  TrackMap() = default;
+  NO_MOVE_NO_COPY(TrackMap);
+
+  /// nullptr if the track is not part of an album
+  const Album* find(const metadb_handle_ptr& track) const;
+  /// Does nothing if the track is mapped already
+  void insert(const metadb_handle_ptr& track, const Album& album);
+  void erase(const metadb_handle_ptr& track);
+  void clear();
+  /// Makes room for `count` tracks without growing again
+  void reserve(size_t count);
+  size_t size() const { return count; }
+  size_t memoryUsage() const { return slots.size() * sizeof(Slot); }
+
+ private:
+  struct Slot {
+    const metadb_handle* track;
+    const Album* album;
+  };
+  size_t home(const metadb_handle* track) const;
+  size_t findSlot(const metadb_handle* track) const;
+  void rehash(size_t capacity);
+
+  // Empty or a power of two, unused slots have no track
+  std::vector<Slot> slots;
+  size_t count = 0;
+  int shift = 64;
 };
 
 using Container = bomi::multi_index_container<
@@ -54,18 +120,21 @@ using Container = bomi::multi_index_container<
 
 class DB {
  public:
-  DB(t_uint64 libraryVersion, const std::string& filterQuery,
-     const std::string& keyFormat, const std::string& sortFormat,
-     const std::string& titleFormat);
+  DB(t_uint64 libraryVersion, Settings settings);
   NO_MOVE_NO_COPY(DB);
 
   Container container;
   Container::index<key>::type& keyIndex;
   Container::index<sortKey>::type& sortIndex;
-  std::map<const metadb_handle_ptr, const db_structure::Album&> trackMap;
+  TrackMap trackMap;
   t_uint64 libraryVersion;
 
+  const Settings settings;
   search_filter_v2::ptr filter;
+  // Filter instances are not meant to be shared between threads, so each shard of
+  // DBWriter::runSharded gets its own. They are created along with `filter`, on the
+  // main thread, as the SDK does not promise that the filter manager works elsewhere.
+  std::vector<search_filter_v2::ptr> shardFilters;
   titleformat_object::ptr keyBuilder;
   titleformat_object::ptr sortFormatter;
   titleformat_object::ptr titleFormatter;
@@ -80,11 +149,40 @@ class DBWriter {
  public:
   explicit DBWriter(db_structure::DB& db) : db(db){};
   NO_MOVE_NO_COPY(DBWriter);
+  /// Splits large batches into shards that are filtered and grouped into albums in
+  /// parallel, then merged in order. The result is the same as adding the tracks one
+  /// by one.
   void add_tracks(metadb_handle_list_cref tracks, abort_callback& abort);
+  /// Fills the empty DB with the `albums` of a DB that was built from `library` with
+  /// the `previous` settings, which used the same key format. Only redoes what the
+  /// changed settings affect: the filter runs over `library` if it changed, and sort
+  /// keys and titles are formatted again if their format or the first track of the
+  /// album changed. The `stale` tracks, whose album might have changed, are grouped
+  /// again. Tracks and albums are ordered by `library`, so the result is the same as
+  /// adding all of `library` with add_tracks.
+  void add_albums(std::vector<db_structure::AlbumData>&& albums,
+                  const db_structure::Settings& previous, metadb_handle_list_cref library,
+                  metadb_handle_list_cref stale, abort_callback& abort);
   void remove_tracks(metadb_handle_list_cref tracks);
   void modify_tracks(metadb_handle_list_cref tracks);
 
  private:
+  /// Calls `fn(begin, end, filter)` for shards of [0, count) in parallel, each with its
+  /// own filter from DB::shardFilters, and returns the results in order
+  template <typename Fn>
+  auto runSharded(t_size count, Fn&& fn);
+  // The albums of one shard of add_tracks, in the order of their first track
+  using Shard = std::vector<db_structure::AlbumData>;
+  /// Filters the tracks in [begin, end) and groups them into albums. Only reads the
+  /// DB, so several shards can run at once, each with its own `filter`.
+  Shard buildShard(metadb_handle_list_cref tracks, t_size begin, t_size end,
+                   const search_filter_v2::ptr& filter, abort_callback& abort) const;
+  void mergeShard(Shard&& shard);
+  /// Whether the tracks in [begin, end) pass `filter`
+  std::vector<bool> filterShard(metadb_handle_list_cref tracks, t_size begin,
+                                t_size end, const search_filter_v2::ptr& filter,
+                                abort_callback& abort) const;
+
   void add_track(const metadb_handle_ptr& track);
   void remove_track(const metadb_handle_ptr& track);
   void update_album_metadata(const db_structure::Album& album);
@@ -101,10 +199,18 @@ class DbAlbumCollection {
   bool initializing() { return !db; }
   bool empty() { return db ? db->container.empty() : true; }
   int size() { return db ? db->container.size() : 0; }
+  /// Changes whenever albums might have been added, removed or reordered
+  unsigned int version() const { return dbVersion; }
 
   AlbumInfo getAlbumInfo(DBIter pos);
-  void getTracks(DBIter pos, metadb_handle_list& out);
+  /// The tracks of the album sorted by cfgInnerSort. Cached until the album's tracks or
+  /// cfgInnerSort change.
+  std::shared_ptr<const metadb_handle_list> getTracks(DBIter pos);
   std::optional<DBPos> getPosForTrack(const metadb_handle_ptr& track);
+  /// The settings of the current DB, nullptr while initializing
+  const db_structure::Settings* settings() const { return db ? &db->settings : nullptr; }
+  /// The albums in sort order, for a reload that starts from them
+  std::vector<db_structure::AlbumData> copyAlbums() const;
 
   template <class T>
   DBPos posFromIter(T iter) const {
@@ -143,4 +249,8 @@ class DbAlbumCollection {
   std::vector<std::tuple<t_uint64, LibraryChangeType, metadb_handle_list>>
       libraryChangeQueue;
   unique_ptr<db_structure::DB> db;
+  unsigned int dbVersion = 0;
+  // cfgInnerSort as compiled for getTracks
+  std::string innerSort;
+  titleformat_object::ptr innerSortScript;
 };
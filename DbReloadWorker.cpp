@@ -1,12 +1,45 @@
 #include "DbReloadWorker.h"
 
+#include "DbSnapshot.h"
 #include "Engine.h"
 #include "EngineThread.h"
 #include "config.h"
 #include "utils.h"
 
-DbReloadWorker::DbReloadWorker(EngineThread& engineThread)
+namespace {
+// What the track map used to take per track as a std::map: a tree node with three
+// pointers, the color flags, the track handle and the album reference, plus the heap
+// block header
+constexpr double treeMapBytesPerTrack = 6 * sizeof(void*) + 16;
+
+#ifdef _DEBUG
+/// Whether both DBs hold the same albums with the same tracks in the same order
+bool sameAlbums(const db_structure::DB& a, const db_structure::DB& b) {
+  if (a.container.size() != b.container.size())
+    return false;
+  auto other = b.sortIndex.begin();
+  for (const auto& album : a.sortIndex) {
+    if (album.key != other->key || album.sortKey != other->sortKey ||
+        album.title != other->title ||
+        album.tracks.get_count() != other->tracks.get_count())
+      return false;
+    for (t_size i = 0; i < album.tracks.get_count(); i++) {
+      if (album.tracks[i] != other->tracks[i])
+        return false;
+    }
+    ++other;
+  }
+  return true;
+}
+#endif
+}  // namespace
+
+DbReloadWorker::DbReloadWorker(EngineThread& engineThread,
+                               const db_structure::Settings* current, bool useSnapshot,
+                               metadb_handle_list reconcile)
     : engineThread(engineThread),
+      previous(current ? std::make_optional(*current) : std::nullopt),
+      useSnapshot(useSnapshot), reconcile(std::move(reconcile)),
       thread(catchThreadExceptions("DBReloadWorker", [&] { this->threadProc(); })) {
   SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL);
   SetThreadPriorityBoost(thread.native_handle(), TRUE);
@@ -27,14 +60,30 @@ void DbReloadWorker::threadProc() {
   TRACK_CALL_TEXT("DbReloadWorker::threadProc");
   pfc::hires_timer timer;
   timer.start();
+  // Debug builds check partial reloads against a full rebuild
+  IF_DEBUG(std::unique_ptr<db_structure::DB> fullBuild);
 
   engineThread.runInMainThread([&] {
     ++engineThread.libraryVersion;
-    db = make_unique<db_structure::DB>(
-        engineThread.libraryVersion, cfgFilter.c_str(), cfgGroup.c_str(),
-        (cfgSortGroup ? "" : cfgSort.c_str()), cfgAlbumTitle.c_str());
+    db_structure::Settings settings{cfgFilter.c_str(), cfgGroup.c_str(),
+                                    (cfgSortGroup ? "" : cfgSort.c_str()),
+                                    cfgAlbumTitle.c_str()};
+    // A reload without changed settings or tracks to reconcile is a request to start
+    // over
+    if (!previous || previous->keyFormat != settings.keyFormat ||
+        (*previous == settings && reconcile.get_count() == 0))
+      previous.reset();
+    db = make_unique<db_structure::DB>(engineThread.libraryVersion, std::move(settings));
+#ifdef _DEBUG
+    if (previous)
+      fullBuild = make_unique<db_structure::DB>(db->libraryVersion, db->settings);
+#endif
     // copy whole library
     library_manager::get()->get_all_items(library);
+    // The engine applies all library changes from before this point to its albums
+    // before it copies them, later ones are queued for the new DB
+    if (previous)
+      currentAlbums = engineThread.sendSync<EM::CopyAlbums>();
     try {
       copyDone.set_value();
     } catch (std::future_error&) {
@@ -44,11 +93,55 @@ void DbReloadWorker::threadProc() {
   copyDone.get_future().wait();
   abort.check();
 
-  DBWriter(*db).add_tracks(std::move(library), abort);
+  std::optional<size_t> changes;
+  if (previous) {
+    // The engine might drop this worker instead of answering
+    while (currentAlbums.wait_for(std::chrono::milliseconds(50)) !=
+           std::future_status::ready) {
+      abort.check();
+    }
+    std::vector<db_structure::AlbumData> albums;
+    try {
+      albums = currentAlbums.get();
+    } catch (std::future_error&) {
+      return;  // shutting down
+    }
+    DBWriter(*db).add_albums(std::move(albums), previous.value(), library, reconcile,
+                             abort);
+#ifdef _DEBUG
+    DBWriter(*fullBuild).add_tracks(library, abort);
+    PFC_ASSERT(sameAlbums(*db, *fullBuild));
+#endif
+  } else {
+    if (useSnapshot)
+      changes = db_snapshot::load(*db, library, stale, abort);
+    if (!changes)
+      DBWriter(*db).add_tracks(library, abort);
+  }
   abort.check();
+  // After a snapshot with stale tracks, the reload that reconciles them saves it
+  if (!changes || (changes.value() > 0 && stale.get_count() == 0))
+    db_snapshot::save(*db, library);
 
-  FB2K_console_formatter() << "foo_chronflow collection generated in: "
-                           << pfc::format_time_ex(timer.query(), 6);
+  {
+    console::formatter log;
+    log << "foo_chronflow collection ";
+    if (previous) {
+      log << (reconcile.get_count() > 0 ? "reconciled" : "updated");
+    } else if (changes) {
+      log << "loaded from snapshot with " << changes.value() << " changed tracks";
+    } else {
+      log << "generated";
+    }
+    log << " in: " << pfc::format_time_ex(timer.query(), 6);
+    const auto& trackMap = db->trackMap;
+    if (trackMap.size() > 0) {
+      double perTrack = double(trackMap.memoryUsage()) / trackMap.size();
+      log << ", track map: " << pfc::format_float(perTrack, 0, 1) << " bytes per track, "
+          << pfc::format_float(treeMapBytesPerTrack - perTrack, 0, 1)
+          << " less than a tree";
+    }
+  }
   completed = true;
   engineThread.send<EM::CollectionReloadedMessage>();
 };
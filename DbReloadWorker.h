@@ -9,13 +9,30 @@ class DbReloadWorker {
   EngineThread& engineThread;
   std::promise<void> copyDone;
   abort_callback_impl abort;
+  std::optional<db_structure::Settings> previous;
+  bool useSnapshot;
+  // The albums of the current DB, if the reload starts from them
+  std::future<std::vector<db_structure::AlbumData>> currentAlbums;
 
  public:
-  explicit DbReloadWorker(EngineThread& engineThread);
+  /// If the settings changed since the `current` DB was built, but not its key format,
+  /// only the stages that depend on the changed settings run again, see
+  /// DBWriter::add_albums. Otherwise the DB is rebuilt from scratch, starting from the
+  /// snapshot of the last build with `useSnapshot`, see DbSnapshot.
+  /// `reconcile` lists the tracks of the `current` DB whose album might have changed.
+  /// If there are any, the reload starts from the current DB even if the settings did
+  /// not change.
+  DbReloadWorker(EngineThread& engineThread, const db_structure::Settings* current,
+                 bool useSnapshot = false, metadb_handle_list reconcile = {});
   NO_MOVE_NO_COPY(DbReloadWorker);
   ~DbReloadWorker();
 
+  // See the constructor. A reload that replaces this one has to reconcile these too.
+  const metadb_handle_list reconcile;
   unique_ptr<db_structure::DB> db;
+  // Set along with `db` when it comes from a snapshot, see db_snapshot::load. The engine
+  // shows the snapshot right away and reconciles these tracks with another reload.
+  metadb_handle_list stale;
   std::atomic<bool> completed = false;
 
  private:
@@ -0,0 +1,284 @@
+#include "DbSnapshot.h"
+
+#include "utils.h"
+
+namespace db_snapshot {
+namespace {
+constexpr uint32_t snapshotMagic = 0x42444643;  // "CFDB"
+constexpr uint32_t snapshotVersion = 1;
+// Anything bigger is not a snapshot we wrote
+constexpr t_uint64 maxSnapshotSize = t_uint64{1} << 30;
+constexpr t_size notInLibrary = ~t_size{0};
+
+const wchar_t* snapshotPath() {
+  static std::wstring path = profileFile("foo_chronflow_albums.snapshot");
+  return path.c_str();
+}
+
+std::string locationKey(const char* path, uint32_t subsong) {
+  std::string key = path;
+  key.append(reinterpret_cast<const char*>(&subsong), sizeof(subsong));
+  return key;
+}
+
+class Writer {
+ public:
+  template <typename T>
+  void put(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  void putString(const char* s, size_t length) {
+    put(uint32_t(length));
+    data.append(s, length);
+  }
+  void putString(const std::string& s) { putString(s.data(), s.size()); }
+  void putString(const std::wstring& s) {
+    put(uint32_t(s.size()));
+    data.append(reinterpret_cast<const char*>(s.data()), s.size() * sizeof(wchar_t));
+  }
+
+  std::string data;
+};
+
+/// Reads values until the data runs out, after that everything reads as empty
+class Reader {
+ public:
+  explicit Reader(const std::string& data) : data(data) {}
+
+  template <typename T>
+  T get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value{};
+    read(&value, sizeof(T));
+    return value;
+  }
+  template <typename String>
+  String getString() {
+    auto length = get<uint32_t>();
+    if (length > (data.size() - pos) / sizeof(typename String::value_type)) {
+      failed = true;
+      return {};
+    }
+    String s(length, 0);
+    read(s.data(), length * sizeof(typename String::value_type));
+    return s;
+  }
+  bool ok() const { return !failed; }
+  size_t remaining() const { return data.size() - pos; }
+
+ private:
+  void read(void* out, size_t size) {
+    if (failed || size > data.size() - pos) {
+      failed = true;
+      return;
+    }
+    std::memcpy(out, data.data() + pos, size);
+    pos += size;
+  }
+
+  const std::string& data;
+  size_t pos = 0;
+  bool failed = false;
+};
+
+bool readSnapshot(std::string& out) {
+  wil::unique_hfile file{CreateFileW(snapshotPath(), GENERIC_READ, 0, nullptr,
+                                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr)};
+  if (!file)
+    return false;
+  LARGE_INTEGER size{};
+  if (0 == GetFileSizeEx(file.get(), &size) || t_uint64(size.QuadPart) > maxSnapshotSize)
+    return false;
+  out.resize(size_t(size.QuadPart));
+  DWORD read = 0;
+  return 0 != ReadFile(file.get(), out.data(), DWORD(out.size()), &read, nullptr) &&
+         read == out.size();
+}
+
+struct StoredAlbum {
+  std::string key;
+  std::wstring sortKey;
+  std::string title;
+  std::vector<uint32_t> tracks;
+};
+}  // namespace
+
+std::optional<size_t> load(db_structure::DB& db, metadb_handle_list_cref library,
+                           metadb_handle_list& stale, abort_callback& abort) {
+  std::string data;
+  if (!readSnapshot(data))
+    return std::nullopt;
+  Reader in(data);
+  if (in.get<uint32_t>() != snapshotMagic || in.get<uint32_t>() != snapshotVersion ||
+      in.getString<std::string>() != db.settings.filterQuery ||
+      in.getString<std::string>() != db.settings.keyFormat ||
+      in.getString<std::string>() != db.settings.sortFormat ||
+      in.getString<std::string>() != db.settings.titleFormat) {
+    return std::nullopt;
+  }
+
+  std::unordered_map<std::string, t_size> libraryIndex;
+  libraryIndex.reserve(library.get_count());
+  for (t_size i = 0; i < library.get_count(); i++) {
+    const metadb_handle_ptr& track = library[i];
+    libraryIndex.emplace(locationKey(track->get_path(), track->get_subsong_index()), i);
+  }
+  abort.check();
+
+  // Maps the stored tracks to the library tracks that are still there. Tracks whose
+  // file changed are stale, the new ones are counted below.
+  size_t changes = 0;
+  auto trackCount = in.get<uint32_t>();
+  if (trackCount > in.remaining())
+    return std::nullopt;
+  std::vector<t_size> tracks(trackCount, notInLibrary);
+  std::vector<bool> stored(library.get_count(), false);
+  std::vector<bool> isStale(library.get_count(), false);
+  std::string path;
+  for (uint32_t i = 0; i < trackCount && in.ok(); i++) {
+    auto shared = in.get<uint32_t>();
+    auto suffix = in.getString<std::string>();
+    auto subsong = in.get<uint32_t>();
+    auto size = in.get<t_uint64>();
+    auto timestamp = in.get<t_uint64>();
+    if (shared > path.size())
+      return std::nullopt;
+    path.resize(shared);
+    path += suffix;
+    auto match = libraryIndex.find(locationKey(path.c_str(), subsong));
+    if (match == libraryIndex.end()) {
+      changes++;
+      continue;
+    }
+    tracks[i] = match->second;
+    stored[match->second] = true;
+    t_filestats stats = library[match->second]->get_filestats();
+    if (stats.m_size != size || stats.m_timestamp != timestamp) {
+      isStale[match->second] = true;
+      changes++;
+    }
+  }
+  abort.check();
+
+  auto albumCount = in.get<uint32_t>();
+  if (albumCount > in.remaining())
+    return std::nullopt;
+  std::vector<StoredAlbum> albums(albumCount);
+  for (auto& album : albums) {
+    album.key = in.getString<std::string>();
+    album.sortKey = in.getString<std::wstring>();
+    album.title = in.getString<std::string>();
+    auto albumTracks = in.get<uint32_t>();
+    if (albumTracks > in.remaining() / sizeof(uint32_t))
+      return std::nullopt;
+    album.tracks.resize(albumTracks);
+    for (auto& track : album.tracks) {
+      track = in.get<uint32_t>();
+      if (track >= trackCount)
+        return std::nullopt;
+    }
+    if (!in.ok())
+      return std::nullopt;
+  }
+  if (!in.ok() || in.remaining() != 0)
+    return std::nullopt;
+
+  // Albums are inserted in sort order, so albums with equal sort keys keep their order.
+  // The sort key and title of an album that lost tracks might come from one of them,
+  // so its other tracks are stale.
+  auto inLibrary = [&](uint32_t track) { return tracks[track] != notInLibrary; };
+  for (auto& album : albums) {
+    bool intact = std::all_of(album.tracks.begin(), album.tracks.end(), inLibrary);
+    if (!std::any_of(album.tracks.begin(), album.tracks.end(), inLibrary))
+      continue;
+    auto [entry, isNew] = db.container.emplace(album.key.c_str(), album.sortKey.c_str(),
+                                               album.title.c_str());
+    if (!isNew) {
+      db.trackMap.clear();
+      db.container.clear();
+      return std::nullopt;
+    }
+    for (uint32_t track : album.tracks) {
+      if (!inLibrary(track))
+        continue;
+      if (!intact)
+        isStale[tracks[track]] = true;
+      entry->tracks.add_item(library[tracks[track]]);
+      db.trackMap.insert(library[tracks[track]], *entry);
+    }
+  }
+  abort.check();
+
+  // In library order, like a full build
+  stale.remove_all();
+  for (t_size i = 0; i < library.get_count(); i++) {
+    if (!stored[i]) {
+      isStale[i] = true;
+      changes++;
+    }
+    if (isStale[i])
+      stale.add_item(library[i]);
+  }
+  return changes;
+}
+
+void save(const db_structure::DB& db, metadb_handle_list_cref library) {
+  Writer out;
+  out.put(snapshotMagic);
+  out.put(snapshotVersion);
+  out.putString(db.settings.filterQuery);
+  out.putString(db.settings.keyFormat);
+  out.putString(db.settings.sortFormat);
+  out.putString(db.settings.titleFormat);
+
+  std::unordered_map<const metadb_handle*, uint32_t> trackIndex;
+  trackIndex.reserve(library.get_count());
+  out.put(uint32_t(library.get_count()));
+  std::string_view previous;
+  for (t_size i = 0; i < library.get_count(); i++) {
+    const metadb_handle_ptr& track = library[i];
+    trackIndex.emplace(track.get_ptr(), uint32_t(i));
+    std::string_view path = track->get_path();
+    size_t sharedLength =
+        std::mismatch(path.begin(), path.end(), previous.begin(), previous.end()).first -
+        path.begin();
+    out.put(uint32_t(sharedLength));
+    out.putString(path.data() + sharedLength, path.size() - sharedLength);
+    out.put(uint32_t(track->get_subsong_index()));
+    t_filestats stats = track->get_filestats();
+    out.put(t_uint64(stats.m_size));
+    out.put(t_uint64(stats.m_timestamp));
+    previous = path;
+  }
+
+  out.put(uint32_t(db.container.size()));
+  for (const auto& album : db.sortIndex) {
+    out.putString(album.key);
+    out.putString(album.sortKey);
+    out.putString(album.title);
+    out.put(uint32_t(album.tracks.get_count()));
+    for (const auto& track : album.tracks) {
+      auto index = trackIndex.find(track.get_ptr());
+      if (index == trackIndex.end())
+        return;  // not built from this library
+      out.put(index->second);
+    }
+  }
+
+  std::wstring tmpPath = std::wstring(snapshotPath()) + L".tmp";
+  wil::unique_hfile file{CreateFileW(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                     CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)};
+  if (!file)
+    return;
+  DWORD written = 0;
+  if (0 == WriteFile(file.get(), out.data.data(), DWORD(out.data.size()), &written,
+                     nullptr) ||
+      written != out.data.size()) {
+    return;
+  }
+  file.reset();
+  MoveFileExW(tmpPath.c_str(), snapshotPath(), MOVEFILE_REPLACE_EXISTING);
+}
+
+}  // namespace db_snapshot
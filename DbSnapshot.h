@@ -0,0 +1,29 @@
+#pragma once
+#include "DbAlbumCollection.h"
+#include "utils.h"
+
+/// On-disk copy of the album index, so that startup doesn't have to build the
+/// collection from scratch.
+///
+/// Holds the albums with their keys, sort keys, titles and tracks, the settings they
+/// were built with, and the file stats of every library track, including the ones the
+/// filter rejected. Tracks are stored by location. Each path leaves out the prefix it
+/// shares with the previous one, as the library lists the tracks of a folder together.
+namespace db_snapshot {
+
+/// Fills the empty `db` from the snapshot, if it was built with the same settings.
+/// Tracks that left `library` are dropped, everything else is taken as it was saved.
+/// `stale` receives the tracks whose album might have changed since: new tracks,
+/// tracks whose file changed, and the other tracks of albums that lost tracks. These
+/// are for DBWriter::add_albums to group again.
+/// Returns the number of tracks that were added, changed or removed since the
+/// snapshot was saved, or nullopt if there is no usable snapshot. `db` stays empty in
+/// that case.
+std::optional<size_t> load(db_structure::DB& db, metadb_handle_list_cref library,
+                           metadb_handle_list& stale, abort_callback& abort);
+
+/// Replaces the snapshot with `db` and the file stats of the `library` it was built
+/// from
+void save(const db_structure::DB& db, metadb_handle_list_cref library);
+
+}  // namespace db_snapshot
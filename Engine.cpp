@@ -29,11 +29,14 @@ int HighTimerResolution::get() {
 Engine::Engine(EngineThread& thread, EngineWindow& window, StyleManager& styleManager)
     : window(window), thread(thread), styleManager(styleManager), glContext(window),
       findAsYouType(*this), coverPos(sessionCompiledCPInfo.get()), worldState(db),
-      texCache(thread, db, coverPos), renderer(*this), playbackTracer(thread) {}
+      texCache(thread, db, coverPos, worldState), renderer(*this),
+      playbackTracer(thread) {}
 
 void Engine::mainLoop() {
   updateRefreshRate();
-  EM::ReloadCollection().execute(*this);
+  // Only the first load starts from the snapshot
+  reloadWorker = make_unique<DbReloadWorker>(thread, nullptr, true);
+  windowDirty = true;
 
   double lastSwapEnd = 0;
   double swapEstimate = 1;
@@ -67,7 +70,13 @@ void Engine::mainLoop() {
       glFinish();
       fpsCounter.endFrame();
 
-      windowDirty = worldState.isMoving() || renderer.wasMissingTextures || reloadWorker;
+      // The loader only wakes us up for results that arrive while nothing waits for
+      // upload
+      windowDirty = worldState.isMoving() || renderer.wasMissingTextures ||
+                    texCache.hasPendingUploads() || reloadWorker;
+      if (!worldState.isMoving() &&
+          (texCache.hasDeferredLoads() || texCache.isLoadingAhead()))
+        cacheDirty = true;
 
       // Handle V-Sync
       renderer.ensureVSync(cfgVSyncMode != VSYNC_SLEEP_ONLY);
@@ -114,10 +123,9 @@ void Engine::updateRefreshRate() {
 
 void Engine::setTarget(DBPos target, bool userInitiated) {
   if (auto dbIter = db.iterFromPos(target)) {
-    metadb_handle_list tracks;
-    db.getTracks(dbIter.value(), tracks);
+    auto tracks = db.getTracks(dbIter.value());
     thread.runInMainThread([tracks = std::move(tracks), &engineWindow = window] {
-      engineWindow.setSelection(tracks);
+      engineWindow.setSelection(*tracks);
     });
   }
 
@@ -2,6 +2,7 @@
 
 #include "lib/win32_helpers.h"
 
+#include "ArtStats.h"
 #include "ContainerWindow.h"
 #include "Engine.h"
 #include "MyActions.h"
@@ -207,7 +208,7 @@ void EngineWindow::onMouseClick(UINT uMsg, WPARAM /*wParam*/, LPARAM lParam) {
 
 void EngineWindow::doDragStart(const AlbumInfo& album) {
   static_api_ptr_t<playlist_incoming_item_filter> piif;
-  pfc::com_ptr_t<IDataObject> pDataObject = piif->create_dataobject_ex(album.tracks);
+  pfc::com_ptr_t<IDataObject> pDataObject = piif->create_dataobject_ex(*album.tracks);
   pfc::com_ptr_t<IDropSource> pDropSource = TrackDropSource::g_create(hWnd);
 
   DWORD effect;
@@ -267,7 +268,7 @@ bool EngineWindow::onKeyDown(UINT uMsg, WPARAM wParam, LPARAM lParam) {
     static_api_ptr_t<keyboard_shortcut_manager> ksm;
     if (targetAlbum) {
       return ksm->on_keydown_auto_context(
-          targetAlbum->tracks, wParam, contextmenu_item::caller_media_library_viewer);
+          *targetAlbum->tracks, wParam, contextmenu_item::caller_media_library_viewer);
     } else {
       return ksm->on_keydown_auto(wParam);
     }
@@ -324,6 +325,8 @@ void EngineWindow::onContextMenu(const int x, const int y) {
     ID_DOUBLECLICK,
     ID_MIDDLECLICK,
     ID_PREFERENCES,
+    ID_DUMP_ART_STATS,
+    ID_RESET_ART_STATS,
     ID_CONTEXT_FIRST,
     ID_CONTEXT_LAST = ID_CONTEXT_FIRST + 1000,
   };
@@ -345,7 +348,7 @@ void EngineWindow::onContextMenu(const int x, const int y) {
                   PFC_string_formatter() << cfgMiddleClick << "\tMiddle Click");
     }
 
-    cmm->init_context(target->tracks, contextmenu_manager::FLAG_SHOW_SHORTCUTS);
+    cmm->init_context(*target->tracks, contextmenu_manager::FLAG_SHOW_SHORTCUTS);
     if (cmm->get_root() != nullptr) {
       if (GetMenuItemCount(hMenu) > 0)
         uAppendMenu(hMenu, MF_SEPARATOR, 0, nullptr);
@@ -353,6 +356,11 @@ void EngineWindow::onContextMenu(const int x, const int y) {
       uAppendMenu(hMenu, MF_SEPARATOR, 0, nullptr);
     }
   }
+  // Diagnostics for slow art loading, offered along with the FPS overlay
+  if (cfgShowFps) {
+    uAppendMenu(hMenu, MF_STRING, ID_DUMP_ART_STATS, "Dump Art Loading Statistics");
+    uAppendMenu(hMenu, MF_STRING, ID_RESET_ART_STATS, "Reset Art Loading Statistics");
+  }
   uAppendMenu(hMenu, MF_STRING, ID_PREFERENCES, "Coverflow Preferences...");
 
   menu_helpers::win32_auto_mnemonics(hMenu);
@@ -362,6 +370,10 @@ void EngineWindow::onContextMenu(const int x, const int y) {
   DestroyMenu(hMenu);
   if (cmd == ID_PREFERENCES) {
     static_api_ptr_t<ui_control>()->show_preferences(guid_configWindow);
+  } else if (cmd == ID_DUMP_ART_STATS) {
+    ArtStats::dump();
+  } else if (cmd == ID_RESET_ART_STATS) {
+    ArtStats::reset();
   } else if (cmd == ID_ENTER) {
     executeAction(cfgEnterKey, target.value());
   } else if (cmd == ID_DOUBLECLICK) {
@@ -24,6 +24,7 @@ GLContext::GLContext(EngineWindow& window) {
     throw std::exception("OpenGL 2.1 is not supported");
   if (!GLAD_GL_EXT_texture_filter_anisotropic)
     throw std::exception("Missing support for anisotropic textures");
+  bc1Support = GLFW_TRUE == glfwExtensionSupported("GL_EXT_texture_compression_s3tc");
 
   IF_DEBUG(glEnable(GL_DEBUG_OUTPUT));
   IF_DEBUG(glDebugMessageCallback(glMessageCallback, 0));
@@ -35,6 +36,8 @@ GLContext::GLContext(EngineWindow& window) {
   glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
   glHint(GL_TEXTURE_COMPRESSION_HINT, GL_FASTEST);
   glEnable(GL_TEXTURE_2D);
+  // Our RGB images are tightly packed, small mip levels have unaligned rows
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   glFogi(GL_FOG_MODE, GL_EXP);
   glFogf(GL_FOG_DENSITY, 5);
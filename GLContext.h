@@ -1,6 +1,11 @@
 #pragma once
 #include "utils.h"
 
+// From EXT_texture_compression_s3tc, which our GL loader does not include
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
 class graphics_reset : public std::exception {
   char const* what() const noexcept override { return "graphics driver reset"; }
 };
@@ -12,8 +17,11 @@ class GLContext {
   ~GLContext();
 
   static void checkGraphicsReset();
+  /// Whether BC1 compressed textures can be uploaded. Can be called from any thread.
+  static bool supportsBC1() { return bc1Support; };
 
  private:
   bool wasReset = false;
+  static inline std::atomic<bool> bc1Support = false;
   static thread_local GLContext* currentContext;
 };
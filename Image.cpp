@@ -1,12 +1,13 @@
 #include "Image.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
+// The implementation is in cover_pixels.cpp
 #include "lib/stb_image.h"
-#include "lib/stb_image_resize.h"
 
+#include "ArtStats.h"
 #include "GLContext.h"
+#include "TextureAtlas.h"
 #include "config.h"
+#include "image_kernels.h"
 #include "utils.h"
 
 namespace {
@@ -56,10 +57,129 @@ void fixPath(pfc::string_base& path) {
   if (temp_len > 1)
     path.add_byte(temp[temp_len - 1]);
 }
+
+image_kernels::ResizeFilter resizeFilter() {
+  return image_kernels::ResizeFilter(cfgResizeFilter.get_value());
+}
+
+void swapRedBlue(uint8_t* pixels, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    std::swap(pixels[0], pixels[2]);
+    pixels += 3;
+  }
+}
+
+/// Decodes a JPEG at 1/2, 1/4 or 1/8 of its size. WIC's JPEG decoder does this in the
+/// DCT domain, so we skip most of the IDCT work and never hold the full size bitmap.
+/// Returns nullopt if the buffer is not a JPEG or would not be scaled down.
+std::optional<Image> decodeJpegScaled(const void* buffer, size_t len, int maxSize,
+                                      abort_callback& abort) {
+  const auto* bytes = static_cast<const uint8_t*>(buffer);
+  if (len < 3 || bytes[0] != 0xFF || bytes[1] != 0xD8 || bytes[2] != 0xFF)
+    return std::nullopt;
+
+  wil::com_ptr<IWICImagingFactory> factory;
+  THROW_IF_FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                                   CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)));
+  wil::com_ptr<IWICStream> stream;
+  THROW_IF_FAILED(factory->CreateStream(&stream));
+  THROW_IF_FAILED(stream->InitializeFromMemory(const_cast<BYTE*>(bytes), DWORD(len)));
+  wil::com_ptr<IWICBitmapDecoder> decoder;
+  THROW_IF_FAILED(factory->CreateDecoderFromStream(
+      stream.get(), nullptr, WICDecodeMetadataCacheOnDemand, &decoder));
+  wil::com_ptr<IWICBitmapFrameDecode> frame;
+  THROW_IF_FAILED(decoder->GetFrame(0, &frame));
+  auto transform = frame.try_query<IWICBitmapSourceTransform>();
+  if (!transform)
+    return std::nullopt;
+
+  UINT width = 0;
+  UINT height = 0;
+  THROW_IF_FAILED(frame->GetSize(&width, &height));
+  // Pick the largest reduction that still covers the texture we are going to create
+  int texSize = cover_pixels::textureSize(int(width), int(height), maxSize);
+  UINT scale = 8;
+  while (scale > 1 && (int(width / scale) < texSize || int(height / scale) < texSize))
+    scale /= 2;
+  if (scale == 1)
+    return std::nullopt;
+
+  UINT scaledWidth = width / scale;
+  UINT scaledHeight = height / scale;
+  THROW_IF_FAILED(transform->GetClosestSize(&scaledWidth, &scaledHeight));
+  WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+  THROW_IF_FAILED(transform->GetClosestPixelFormat(&format));
+  if (format != GUID_WICPixelFormat24bppBGR)
+    return std::nullopt;  // grayscale or CMYK, leave those to stb_image
+
+  UINT stride = scaledWidth * 3;
+  UINT bufferSize = stride * scaledHeight;
+  Image::malloc_ptr data{BufferPool::allocate(bufferSize)};
+  if (data == nullptr)
+    throw std::bad_alloc{};
+  // Decode in strips, so we can stop early
+  constexpr UINT stripHeight = 64;
+  for (UINT y = 0; y < scaledHeight; y += stripHeight) {
+    abort.check();
+    UINT rows = std::min(stripHeight, scaledHeight - y);
+    WICRect strip{0, INT(y), INT(scaledWidth), INT(rows)};
+    THROW_IF_FAILED(transform->CopyPixels(&strip, scaledWidth, scaledHeight, &format,
+                                          WICBitmapTransformRotate0, stride,
+                                          stride * rows,
+                                          static_cast<BYTE*>(data.get()) + y * stride));
+  }
+  swapRedBlue(static_cast<uint8_t*>(data.get()), size_t(scaledWidth) * scaledHeight);
+  return Image{std::move(data), int(scaledWidth), int(scaledHeight)};
+}
+
+/// Feeds stb_image from memory. Reports the end of the data once `abort` is set, so
+/// that a long decode fails early.
+struct AbortableReader {
+  const stbi_uc* data;
+  size_t size;
+  size_t position;
+  abort_callback& abort;
+
+  static int read(void* user, char* out, int count) {
+    auto& reader = *static_cast<AbortableReader*>(user);
+    if (reader.abort.is_aborting())
+      return 0;
+    size_t n = std::min(size_t(count), reader.size - reader.position);
+    std::memcpy(out, reader.data + reader.position, n);
+    reader.position += n;
+    return int(n);
+  }
+  static void skip(void* user, int n) {
+    auto& reader = *static_cast<AbortableReader*>(user);
+    reader.position = std::min(reader.size, reader.position + size_t(n));
+  }
+  static int eof(void* user) {
+    auto& reader = *static_cast<AbortableReader*>(user);
+    return reader.position >= reader.size || reader.abort.is_aborting() ? 1 : 0;
+  }
+};
+
+Image decodeAbortable(const void* buffer, size_t len, abort_callback& abort) {
+  AbortableReader reader{static_cast<const stbi_uc*>(buffer), len, 0, abort};
+  stbi_io_callbacks callbacks{&AbortableReader::read, &AbortableReader::skip,
+                              &AbortableReader::eof};
+  int width;
+  int height;
+  int channels_in_file;
+  Image::malloc_ptr data{static_cast<void*>(stbi_load_from_callbacks(
+      &callbacks, &reader, &width, &height, &channels_in_file, 3))};
+  abort.check();
+  if (data == nullptr) {
+    throw std::runtime_error{"Failed to load image buffer"};
+  }
+  return Image{std::move(data), width, height};
+}
 }  // namespace
 
 Image::Image(malloc_ptr data, int width, int height)
-    : width(width), height(height), data(std::move(data)) {}
+    : Pixels{width, height, std::move(data)} {}
+
+Image::Image(cover_pixels::Pixels&& pixels) : Pixels(std::move(pixels)) {}
 
 Image Image::fromFile(const char* filename) {
   auto wideName = pfc::stringcvt::string_wide_from_utf8(filename);
@@ -79,15 +199,18 @@ Image Image::fromFile(const char* filename) {
 }
 
 Image Image::fromFileBuffer(const void* buffer, size_t len) {
-  int width;
-  int height;
-  int channels_in_file;
-  malloc_ptr data{static_cast<void*>(stbi_load_from_memory(
-      static_cast<const stbi_uc*>(buffer), len, &width, &height, &channels_in_file, 3))};
-  if (data == nullptr) {
-    throw std::runtime_error{"Failed to load image buffer"};
+  return Image{cover_pixels::decode(buffer, len)};
+}
+
+Image Image::fromFileBufferScaled(const void* buffer, size_t len, int maxSize,
+                                  abort_callback& abort) {
+  try {
+    if (auto image = decodeJpegScaled(buffer, len, maxSize, abort))
+      return std::move(image.value());
+  } catch (const wil::ResultException&) {
+    IF_DEBUG(console::out() << "ART [fail] scaled decode, falling back to stb_image");
   }
-  return Image{std::move(data), width, height};
+  return decodeAbortable(buffer, len, abort);
 }
 
 Image Image::fromResource(LPCTSTR pName, LPCTSTR pType, HMODULE hInst) {
@@ -124,67 +247,54 @@ Image Image::fromGdiBitmap(Gdiplus::Bitmap& bitmap) {
   }
   auto _ = gsl::finally([&] { bitmap.UnlockBits(&bitmapData); });
   size_t bufferSize = bitmapData.Width * bitmapData.Height * 3;
-  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
-  malloc_ptr outBuffer{malloc(bufferSize)};
+  malloc_ptr outBuffer{BufferPool::allocate(bufferSize)};
   if (outBuffer == nullptr) {
     throw std::bad_alloc{};
   }
   memcpy(outBuffer.get(), bitmapData.Scan0, bufferSize);
 
-  // convert bgr to rgb
-  auto* p = static_cast<uint8_t*>(outBuffer.get());
-  for (t_size i = 0; i < bitmapData.Width * bitmapData.Height; ++i) {
-    stbi_uc t = p[0];
-    p[0] = p[2];
-    p[2] = t;
-    p += 3;
-  }
+  swapRedBlue(static_cast<uint8_t*>(outBuffer.get()),
+              size_t(bitmapData.Width) * bitmapData.Height);
 
   return Image(std::move(outBuffer), bitmapData.Width, bitmapData.Height);
 }
 
 Image Image::resize(int width, int height) const {
-  size_t new_size = width * height * 3;
-  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
-  malloc_ptr new_buffer{static_cast<stbi_uc*>(malloc(new_size))};
-  if (new_buffer == nullptr) {
-    throw std::bad_alloc{};
-  }
-  int result =
-      stbir_resize_uint8_srgb(static_cast<stbi_uc*>(data.get()), this->width,
-                              this->height, 0, static_cast<stbi_uc*>(new_buffer.get()),
-                              width, height, 0, 3, STBIR_ALPHA_CHANNEL_NONE, 0);
-  if (result != 1) {
-    throw std::runtime_error{"Failed to resize image"};
-  }
-  return Image{std::move(new_buffer), width, height};
+  return Image{cover_pixels::resize(*this, width, height, resizeFilter(), cfgResizeSrgb)};
 }
 
-std::optional<UploadReadyImage> loadAlbumArt(const metadb_handle_ptr& track,
-                                             abort_callback& abort) {
-  IF_DEBUG(double preLoad = time());
+FetchedArt fetchAlbumArt(const metadb_handle_ptr& track, abort_callback& abort) {
+  double preLoad = time();
+  auto step = ArtStats::Stage::open;
+  double stepStart = preLoad;
+  auto finishStep = [&] { ArtStats::record(step, time() - stepStart); };
   static_api_ptr_t<album_art_manager_v2> aam;
-  auto extractor = aam->open(pfc::list_single_ref_t(track),
-                             pfc::list_single_ref_t(album_art_ids::cover_front), abort);
   try {
+    auto extractor = aam->open(pfc::list_single_ref_t(track),
+                               pfc::list_single_ref_t(album_art_ids::cover_front), abort);
+    finishStep();
+    step = ArtStats::Stage::query;
+    stepStart = time();
     auto art = extractor->query(album_art_ids::cover_front, abort);
-    Image image = Image::fromFileBuffer(art->get_ptr(), art->get_size());
-
-    IF_DEBUG(auto x = gsl::finally([&] {
-               console::out() << "ART [done] " << std::setw(6)
-                              << (1000 * (time() - preLoad)) << " ms";
-             }));
-    return UploadReadyImage(std::move(image));
+    finishStep();
+    ArtStats::count(ArtStats::Outcome::found);
+    IF_DEBUG(console::out() << "ART [done] " << std::setw(6)
+                            << (1000 * (time() - preLoad)) << " ms");
+    return FetchedArt{art};
   } catch (const exception_album_art_not_found&) {
+    finishStep();
+    ArtStats::count(ArtStats::Outcome::missing);
     IF_DEBUG(console::out() << "ART [miss] " << std::setw(6)
                             << (1000 * (time() - preLoad)) << " ms");
-    return std::nullopt;
+    return FetchedArt{{}, true};
   } catch (const exception_aborted&) {
     throw;
   } catch (...) {
+    finishStep();
+    ArtStats::count(ArtStats::Outcome::failed);
     IF_DEBUG(console::out() << "ART [fail] " << std::setw(6)
                             << (1000 * (time() - preLoad)) << " ms");
-    return std::nullopt;
+    return {};
   }
 }
 
@@ -202,66 +312,89 @@ UploadReadyImage loadSpecialArt(WORD resource, pfc::string8 userImage) {
       Image::fromResource(resource, L"JPG", core_api::get_my_instance()));
 }
 
-UploadReadyImage::UploadReadyImage(Image&& src)
-    : image(std::move(src)), originalAspect(double(src.width) / src.height) {
-  const int maxSize = std::min(cfgMaxTextureSize.get_value(), 1024);
+int maxTextureSize(TextureTier tier) {
+  const int maxSize =
+      std::min(cfgMaxTextureSize.get_value(), cover_pixels::textureSizeLimit);
+  if (tier == TextureTier::proxy)
+    return std::min(maxSize, cover_pixels::proxySizeLimit);
+  return maxSize;
+}
 
-  int width = image.width;
-  int height = image.height;
+int textureSize(TextureTier tier) {
+  return cover_pixels::powerOfTwo(maxTextureSize(tier));
+}
 
-  // scale textures down to maxSize
-  if ((width > maxSize) || (height > maxSize)) {
-    if (width > height) {
-      height = int(maxSize / originalAspect);
-      width = maxSize;
-    } else {
-      width = int(originalAspect * maxSize);
-      height = maxSize;
-    }
-  }
+UploadReadyImage::UploadReadyImage(Image&& src, TextureTier tier)
+    : image(cover_pixels::toTexture(std::move(src), maxTextureSize(tier), resizeFilter(),
+                                    cfgResizeSrgb)),
+      originalAspect(double(src.width) / src.height) {
+  generateMipmaps();
+}
 
-  // turn texture sizes into powers of two
-  int p2w = 1;
-  while (p2w < width) p2w = p2w << 1;
-  width = p2w;
-  int p2h = 1;
-  while (p2h < height) p2h = p2h << 1;
-  height = p2h;
+UploadReadyImage::UploadReadyImage(Image&& image, double originalAspect)
+    : image(std::move(image)), originalAspect(originalAspect) {
+  generateMipmaps();
+}
 
-  if (width != image.width || height != image.height) {
-    image = image.resize(width, height);
+void UploadReadyImage::generateMipmaps() {
+  for (auto& level : cover_pixels::mipmaps(image)) {
+    mipmaps.emplace_back(std::move(level));
   }
 }
 
 UploadReadyImage& UploadReadyImage::operator=(UploadReadyImage&& other) {
   originalAspect = other.originalAspect;
+  compressed = other.compressed;
   image = std::move(other.image);
+  mipmaps = std::move(other.mipmaps);
   return *this;
 }
 
+void UploadReadyImage::compress() {
+  if (compressed)
+    return;
+  cover_pixels::compress(image);
+  for (auto& mipmap : mipmaps) {
+    cover_pixels::compress(mipmap);
+  }
+  compressed = true;
+}
+
+size_t UploadReadyImage::memorySize() const {
+  size_t size = cover_pixels::memorySize(image, compressed);
+  for (auto& mipmap : mipmaps) {
+    size += cover_pixels::memorySize(mipmap, compressed);
+  }
+  return size;
+}
+
 GLImage UploadReadyImage::upload() const {
   TRACK_CALL_TEXT("UploadReadyImage::upload");
   IF_DEBUG(double preLoad = time());
   GLTexture texture{};
   texture.bind();
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(mipmaps.size()));
   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-  GLint glInternalFormat;
-  if (cfgTextureCompression) {
-    glInternalFormat = GL_COMPRESSED_RGB;
-  } else {
-    glInternalFormat = GL_RGB;
-  }
-
   GLContext::checkGraphicsReset();
-  glTexImage2D(GL_TEXTURE_2D, 0, glInternalFormat, image.width, image.height, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, image.data.get());
+  for (size_t i = 0; i <= mipmaps.size(); i++) {
+    const Image& level = i == 0 ? image : mipmaps[i - 1];
+    if (compressed) {
+      glCompressedTexImage2D(
+          GL_TEXTURE_2D, GLint(i), GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.width,
+          level.height, 0, GLsizei(image_kernels::bc1Size(level.width, level.height)),
+          level.data.get());
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, GLint(i), GL_RGB, level.width, level.height, 0, GL_RGB,
+                   GL_UNSIGNED_BYTE, level.data.get());
+    }
+  }
   IF_DEBUG(console::out() << "GLUpload " << (time() - preLoad) * 1000 << " ms");
-  return GLImage(std::move(texture), static_cast<float>(originalAspect));
+  return GLImage(std::move(texture), static_cast<float>(originalAspect), memorySize());
 }
 
 GLTexture::GLTexture() {
@@ -296,6 +429,45 @@ void GLTexture::bind() const {
   glBindTexture(GL_TEXTURE_2D, glTexture);
 }
 
+GLImage::GLImage(GLImage&& other) noexcept
+    : glTexture(std::move(other.glTexture)), page(std::exchange(other.page, nullptr)),
+      slot(other.slot), texRect(other.texRect), originalAspect(other.originalAspect),
+      memorySize(other.memorySize) {}
+
+GLImage& GLImage::operator=(GLImage&& other) noexcept {
+  release();
+  glTexture = std::move(other.glTexture);
+  page = std::exchange(other.page, nullptr);
+  slot = other.slot;
+  texRect = other.texRect;
+  originalAspect = other.originalAspect;
+  memorySize = other.memorySize;
+  return *this;
+}
+
+GLImage::~GLImage() noexcept {
+  release();
+}
+
+void GLImage::release() noexcept {
+  if (page != nullptr) {
+    page->atlas.release(*page, slot);
+    page = nullptr;
+  }
+}
+
+void GLImage::bind() const {
+  if (page != nullptr) {
+    page->texture.bind();
+  } else {
+    glTexture->bind();
+  }
+}
+
+GLuint GLImage::textureName() const {
+  return page != nullptr ? page->texture.name() : glTexture->name();
+}
+
 GLImage loadSpinner() {
   LPCWSTR pName = MAKEINTRESOURCE(IDB_SPINNER);
   auto hInst = core_api::get_my_instance();
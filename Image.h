@@ -1,17 +1,23 @@
 #pragma once
+#include "BufferPool.h"
+#include "cover_pixels.h"
 #include "utils.h"
 
-class Image {
+class Image : public cover_pixels::Pixels {
  public:
-  using malloc_ptr = unique_ptr_del<void, &free>;
-  int width;
-  int height;
-  malloc_ptr data;
+  /// Pixel data from BufferPool
+  using malloc_ptr = PooledBuffer;
 
   Image(malloc_ptr data, int width, int height);
+  explicit Image(cover_pixels::Pixels&& pixels);
 
   static Image fromFile(const char* filename);
   static Image fromFileBuffer(const void* buffer, size_t len);
+  /// Like fromFileBuffer, but JPEGs that will end up in a texture of at most `maxSize`
+  /// are decoded at a reduced size right away. Throws exception_aborted soon after
+  /// `abort` is set.
+  static Image fromFileBufferScaled(const void* buffer, size_t len, int maxSize,
+                                    abort_callback& abort);
   static Image fromResource(LPCTSTR pName, LPCTSTR pType, HMODULE hInst);
   static Image fromResource(UINT id, LPCTSTR pType, HMODULE hInst);
   static Image fromGdiBitmap(Gdiplus::Bitmap& bitmap);
@@ -29,44 +35,113 @@ class GLTexture {
   ~GLTexture() noexcept;
 
   void bind() const;
+  GLuint name() const { return glTexture; };
 
  private:
   void reset() noexcept;
   GLuint glTexture = 0;
 };
 
+/// Texture coordinates of an image's edges
+struct TexRect {
+  float left;
+  float top;
+  float right;
+  float bottom;
+};
+
+struct AtlasPage;
+
 class GLImage {
  public:
-  GLImage(GLTexture glTexture, float originalAspect)
-      : glTexture(std::move(glTexture)), originalAspect(originalAspect){};
+  GLImage(GLTexture glTexture, float originalAspect, size_t memorySize = 0)
+      : glTexture(std::move(glTexture)), originalAspect(originalAspect),
+        memorySize(memorySize){};
+  /// An image in a TextureAtlas slot. The slot is freed when the image is destroyed.
+  GLImage(AtlasPage& page, int slot, TexRect texRect, float originalAspect,
+          size_t memorySize)
+      : page(&page), slot(slot), texRect(texRect), originalAspect(originalAspect),
+        memorySize(memorySize){};
+  GLImage(const GLImage&) = delete;
+  GLImage& operator=(const GLImage&) = delete;
+  GLImage(GLImage&&) noexcept;
+  GLImage& operator=(GLImage&&) noexcept;
+  ~GLImage() noexcept;
 
-  void bind() const { glTexture.bind(); };
+  void bind() const;
+  /// The underlying GL texture. Images in the same atlas page share it.
+  GLuint textureName() const;
+  const TexRect& getTexRect() const { return texRect; };
   float getAspect() const { return originalAspect; };
+  /// Video memory taken up by all mip levels
+  size_t getMemorySize() const { return memorySize; };
 
  private:
-  GLTexture glTexture;
+  void release() noexcept;
+
+  std::optional<GLTexture> glTexture;
+  AtlasPage* page = nullptr;
+  int slot = 0;
+  TexRect texRect{0, 0, 1, 1};
   float originalAspect;
+  size_t memorySize;
 };
 
+/// Resolution tiers for progressive loading, in loading order
+enum class TextureTier {
+  proxy,
+  full,
+};
+/// Maximum side length of textures in `tier`
+int maxTextureSize(TextureTier tier);
+/// Side length of the square textures in `tier`. Smaller art gets the smallest power
+/// of two that holds it.
+int textureSize(TextureTier tier);
+
 class UploadReadyImage {
  public:
-  explicit UploadReadyImage(Image&& src);
+  explicit UploadReadyImage(Image&& src, TextureTier tier = TextureTier::full);
+  /// `image` must already be a square texture, sized as the other constructor does
+  UploadReadyImage(Image&& image, double originalAspect);
   UploadReadyImage(const UploadReadyImage&) = delete;
   UploadReadyImage& operator=(const UploadReadyImage&) = delete;
   UploadReadyImage(UploadReadyImage&& other)
-      : image(std::move(other.image)), originalAspect(other.originalAspect){};
+      : image(std::move(other.image)), mipmaps(std::move(other.mipmaps)),
+        originalAspect(other.originalAspect), compressed(other.compressed){};
   UploadReadyImage& operator=(UploadReadyImage&&);
   ~UploadReadyImage() = default;
 
+  /// Replaces the pixels of all levels with BC1 blocks. Only call this if the GL
+  /// context supports BC1 textures.
+  void compress();
+  bool isCompressed() const { return compressed; };
+  /// Bytes held by all levels
+  size_t memorySize() const;
+
   GLImage upload() const;
+  const Image& getImage() const { return image; };
+  const std::vector<Image>& getMipmaps() const { return mipmaps; };
+  double getOriginalAspect() const { return originalAspect; };
 
  private:
+  void generateMipmaps();
+
   Image image;
+  // Mip levels 1..n, down to 1x1
+  std::vector<Image> mipmaps;
   double originalAspect;
+  // Whether the levels hold BC1 blocks instead of RGB pixels
+  bool compressed = false;
 };
 
-std::optional<UploadReadyImage> loadAlbumArt(const metadb_handle_ptr& track,
-                                             abort_callback& abort);
+struct FetchedArt {
+  album_art_data::ptr data;
+  // The extractor reported that there is no art, as opposed to failing to read it
+  bool missing = false;
+};
+/// Returns the raw front cover data for `track`, or an empty pointer if there is none
+/// or it could not be read
+FetchedArt fetchAlbumArt(const metadb_handle_ptr& track, abort_callback& abort);
 UploadReadyImage loadSpecialArt(WORD resource, pfc::string8 userImage);
 
 GLImage loadSpinner();
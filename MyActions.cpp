@@ -81,12 +81,12 @@ std::vector<CustomAction*> g_customActions{
 void executeAction(const char* action, const AlbumInfo& album) {
   for (auto& g_customAction : g_customActions) {
     if (stricmp_utf8(action, g_customAction->actionName) == 0) {
-      g_customAction->run(album.tracks, album.title.c_str());
+      g_customAction->run(*album.tracks, album.title.c_str());
       return;
     }
   }
   GUID commandGuid;
   if (menu_helpers::find_command_by_name(action, commandGuid)) {
-    menu_helpers::run_command_context(commandGuid, pfc::guid_null, album.tracks);
+    menu_helpers::run_command_context(commandGuid, pfc::guid_null, *album.tracks);
   }
 }
@@ -2,6 +2,8 @@
 
 #include "lib/gl_structs.h"
 
+#include "ArtStats.h"
+#include "BufferPool.h"
 #include "DbAlbumCollection.h"
 #include "Engine.h"
 #include "Image.h"
@@ -255,7 +257,7 @@ void Renderer::drawGui() {
       albumTitle = "No Covers to Display";
     } else {
       DBIter iter = engine.db.iterFromPos(engine.worldState.getTarget()).value();
-      albumTitle = engine.db.getAlbumInfo(iter).title;
+      albumTitle = iter->title;
       highlight = engine.findAsYouType.highlightPositions(albumTitle);
     }
     textDisplay.displayText(albumTitle, highlight, int(winWidth * cfgTitlePosH),
@@ -279,6 +281,71 @@ void Renderer::drawGui() {
                            15, winHeight - 20);
     bitmapFont.displayText(dispStringB.str().c_str(), engine.styleManager.getTitleColor(),
                            15, winHeight - 35);
+
+    // Loader pipeline: waiting jobs, then queued+busy/running threads for each stage
+    auto loader = engine.texCache.getLoaderStats();
+    std::ostringstream dispStringC;
+    dispStringC << "art: " << loader.queued << "  fetch " << loader.fetching << "/"
+                << loader.fetchThreads << " (max " << loader.maxFetchThreads << ", "
+                << int(100 * loader.fetchCpuShare) << "% cpu)  decode "
+                << loader.decodeQueue << "+" << loader.decoding << "/"
+                << loader.decodeThreads << "  resize " << loader.resizeQueue << "+"
+                << loader.resizing << "/" << loader.resizeThreads << "  upload "
+                << loader.loaded << "  cancelled " << loader.cancelled << " ("
+                << loader.preempted << " preempted)";
+    bitmapFont.displayText(dispStringC.str().c_str(), engine.styleManager.getTitleColor(),
+                           15, winHeight - 50);
+
+    // Video memory of the cached covers (atlas pages) against the budget, then main
+    // memory waiting for upload and held by the pipeline, in MB
+    auto memory = engine.texCache.getMemoryUsage();
+    auto mb = [](size_t bytes) { return double(bytes) / (1 << 20); };
+    std::ostringstream dispStringD;
+    dispStringD.flags(std::ios_base::fixed);
+    dispStringD.precision(1);
+    dispStringD << "vram: " << mb(memory.textures) << " (" << mb(memory.atlases) << ") / "
+                << mb(memory.budget) << "  ram: upload " << mb(memory.loaded)
+                << "  pipeline " << mb(memory.pipeline);
+    bitmapFont.displayText(dispStringD.str().c_str(), engine.styleManager.getTitleColor(),
+                           15, winHeight - 65);
+
+    // Pixel buffers served by the calling thread's cache and by the shared pool
+    auto pool = BufferPool::getStats();
+    auto percent = [&](uint64_t hits) {
+      return pool.requests > 0 ? 100.0 * double(hits) / double(pool.requests) : 0.0;
+    };
+    std::ostringstream dispStringE;
+    dispStringE.flags(std::ios_base::fixed);
+    dispStringE.precision(1);
+    dispStringE << "buffers: " << pool.requests << "  hits " << percent(pool.threadHits)
+                << "% thread, " << percent(pool.sharedHits) << "% shared  pooled "
+                << mb(pool.pooledBytes);
+    bitmapFont.displayText(dispStringE.str().c_str(), engine.styleManager.getTitleColor(),
+                           15, winHeight - 80);
+
+    // Median and 95th percentile of each art loading stage in ms, and the outcomes.
+    // The percentiles are bucket limits, so they are powers of two.
+    auto art = ArtStats::getSnapshot();
+    std::ostringstream dispStringF;
+    dispStringF.flags(std::ios_base::fixed);
+    dispStringF.precision(1);
+    dispStringF << "ms p50/p95:";
+    for (int s = 0; s < int(ArtStats::Stage::count); s++) {
+      const auto& histogram = art[ArtStats::Stage(s)];
+      dispStringF << "  " << ArtStats::stageName(ArtStats::Stage(s)) << " "
+                  << 1000 * histogram.quantile(0.5) << "/"
+                  << 1000 * histogram.quantile(0.95);
+    }
+    bitmapFont.displayText(dispStringF.str().c_str(), engine.styleManager.getTitleColor(),
+                           15, winHeight - 95);
+    std::ostringstream dispStringG;
+    dispStringG << "art:";
+    for (int o = 0; o < int(ArtStats::Outcome::count); o++) {
+      dispStringG << "  " << art[ArtStats::Outcome(o)] << " "
+                  << ArtStats::outcomeName(ArtStats::Outcome(o));
+    }
+    bitmapFont.displayText(dispStringG.str().c_str(), engine.styleManager.getTitleColor(),
+                           15, winHeight - 110);
   }
 
   if (engine.reloadWorker)
@@ -375,8 +442,13 @@ void Renderer::drawCovers(bool showTarget) {
     }
   }
 
+  // Covers from the same atlas page share a texture
+  GLuint boundTexture = 0;
   for (Cover cover : covers) {
-    cover.tex->bind();
+    if (cover.tex->textureName() != boundTexture) {
+      cover.tex->bind();
+      boundTexture = cover.tex->textureName();
+    }
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     // calculate darkening
@@ -386,26 +458,27 @@ void Renderer::drawCovers(bool showTarget) {
     glColor3f(g, g, g);
 
     glQuad coverQuad = engine.coverPos.getCoverQuad(cover.offset, cover.tex->getAspect());
+    const TexRect& uv = cover.tex->getTexRect();
     glPushName(SELECTION_CENTER + cover.index);
     glBegin(GL_QUADS);
     glFogCoordf(
         static_cast<GLfloat>(engine.coverPos.distanceToMirror(coverQuad.topLeft)));
-    glTexCoord2f(0.0f, 0.0f);
+    glTexCoord2f(uv.left, uv.top);
     glVertex3fv(coverQuad.topLeft.as_3fv());
 
     glFogCoordf(
         static_cast<GLfloat>(engine.coverPos.distanceToMirror(coverQuad.topRight)));
-    glTexCoord2f(1.0f, 0.0f);
+    glTexCoord2f(uv.right, uv.top);
     glVertex3fv(coverQuad.topRight.as_3fv());
 
     glFogCoordf(
         static_cast<GLfloat>(engine.coverPos.distanceToMirror(coverQuad.bottomRight)));
-    glTexCoord2f(1.0f, 1.0f);
+    glTexCoord2f(uv.right, uv.bottom);
     glVertex3fv(coverQuad.bottomRight.as_3fv());
 
     glFogCoordf(
         static_cast<GLfloat>(engine.coverPos.distanceToMirror(coverQuad.bottomLeft)));
-    glTexCoord2f(0.0f, 1.0f);
+    glTexCoord2f(uv.left, uv.bottom);
     glVertex3fv(coverQuad.bottomLeft.as_3fv());
     glEnd();
     glPopName();
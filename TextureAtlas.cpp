@@ -0,0 +1,170 @@
+#include "TextureAtlas.h"
+
+#include "GLContext.h"
+#include "image_kernels.h"
+
+namespace {
+// Big enough to keep the number of textures low, small enough to not waste much video
+// memory on a half empty page
+constexpr int maxPageSize = 4096;
+constexpr int maxSlotsPerRow = 8;
+
+// Stop while every slot is still this many texels wide. Each further level doubles the
+// inset slotRect needs to keep linear filtering away from the neighboring covers. It is
+// a multiple of the 4x4 blocks BC1 updates.
+constexpr int minSlotLevelSize = 8;
+}  // namespace
+
+TextureAtlas::TextureAtlas(int slotSize, bool compressed)
+    : slotSize(slotSize), compressed(compressed) {
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  int pageLimit = std::min({int(maxTextureSize), maxPageSize, slotSize * maxSlotsPerRow});
+  pageSize = std::max(slotSize, pageLimit);
+  slotsPerRow = pageSize / slotSize;
+  maxLevel = 0;
+  for (int size = slotSize; size > minSlotLevelSize;) {
+    size = image_kernels::mipSize(size);
+    maxLevel++;
+  }
+  for (int level = 0; level <= maxLevel; level++) {
+    pageBytes += levelBytes(pageSize >> level, compressed);
+  }
+  uploadBufferSize = slotBytes(slotSize, compressed);
+  glGenBuffers(uploadBufferCount, uploadBuffers.data());
+}
+
+TextureAtlas::~TextureAtlas() {
+  glDeleteBuffers(uploadBufferCount, uploadBuffers.data());
+}
+
+int TextureAtlas::usedSlots() const {
+  int used = 0;
+  for (auto& page : pages) used += page->used;
+  return used;
+}
+
+AtlasPage& TextureAtlas::addPage() {
+  IF_DEBUG(console::out() << "Atlas page " << pages.size() << " for " << slotSize
+                          << "px covers");
+  auto& page = pages.emplace_back(std::make_unique<AtlasPage>(AtlasPage{*this, {}, {}}));
+  page->texture.bind();
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  GLContext::checkGraphicsReset();
+  for (int level = 0; level <= maxLevel; level++) {
+    int size = pageSize >> level;
+    if (compressed) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size,
+                             size, 0, GLsizei(levelBytes(size, compressed)), nullptr);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, level, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                   nullptr);
+    }
+  }
+  // Hand out low slots first
+  int slotCount = slotsPerRow * slotsPerRow;
+  page->freeSlots.reserve(slotCount);
+  for (int slot = slotCount - 1; slot >= 0; slot--) page->freeSlots.push_back(slot);
+  return *page;
+}
+
+GLImage TextureAtlas::upload(const UploadReadyImage& image) {
+  TRACK_CALL_TEXT("TextureAtlas::upload");
+  const Image& base = image.getImage();
+  PFC_ASSERT(base.width == slotSize && base.height == slotSize);
+  PFC_ASSERT(image.isCompressed() == compressed);
+  // Fill the oldest pages first, so the newer ones have a chance to run empty
+  auto page = std::find_if(pages.begin(), pages.end(),
+                           [](auto& p) { return !p->freeSlots.empty(); });
+  AtlasPage& target = page != pages.end() ? **page : addPage();
+
+  // Stage all levels in the next buffer of the ring. Respecifying the buffer's storage
+  // first means we never wait for the GPU to finish reading its previous contents.
+  const auto& mipmaps = image.getMipmaps();
+  int levels = 1 + std::min(maxLevel, int(mipmaps.size()));
+  auto level = [&](int i) -> const Image& { return i == 0 ? base : mipmaps[i - 1]; };
+  GLContext::checkGraphicsReset();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffers[nextUploadBuffer]);
+  nextUploadBuffer = (nextUploadBuffer + 1) % uploadBufferCount;
+  auto _ = gsl::finally([] { glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); });
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, uploadBufferSize, nullptr, GL_STREAM_DRAW);
+  auto* staging =
+      static_cast<uint8_t*>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+  if (staging == nullptr)
+    throw std::runtime_error{"Failed to map texture upload buffer"};
+  std::array<size_t, 32> offsets{};
+  size_t offset = 0;
+  for (int i = 0; i < levels; i++) {
+    const Image& mip = level(i);
+    size_t size = levelBytes(mip.width, compressed);
+    std::memcpy(staging + offset, mip.data.get(), size);
+    offsets[i] = offset;
+    offset += size;
+  }
+  if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+    throw std::runtime_error{"Texture upload buffer got corrupted"};
+
+  int slot = target.freeSlots.back();
+  target.freeSlots.pop_back();
+  target.used++;
+
+  int x = (slot % slotsPerRow) * slotSize;
+  int y = (slot / slotsPerRow) * slotSize;
+  target.texture.bind();
+  for (int i = 0; i < levels; i++) {
+    const Image& mip = level(i);
+    // With a pixel unpack buffer bound, the data pointer is an offset into the buffer
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    const auto* data = reinterpret_cast<const void*>(offsets[i]);
+    if (compressed) {
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, i, x >> i, y >> i, mip.width, mip.height,
+                                GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                GLsizei(levelBytes(mip.width, compressed)), data);
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, i, x >> i, y >> i, mip.width, mip.height, GL_RGB,
+                      GL_UNSIGNED_BYTE, data);
+    }
+  }
+  return GLImage(target, slot, slotRect(slot), float(image.getOriginalAspect()),
+                 uploadBufferSize);
+}
+
+void TextureAtlas::release(AtlasPage& page, int slot) {
+  page.freeSlots.push_back(slot);
+  page.used--;
+  if (page.used == 0 && pages.size() > 1) {
+    pages.erase(std::find_if(pages.begin(), pages.end(),
+                             [&](auto& p) { return p.get() == &page; }));
+  }
+}
+
+size_t TextureAtlas::slotBytes(int slotSize, bool compressed) {
+  size_t bytes = levelBytes(slotSize, compressed);
+  for (int size = slotSize; size > minSlotLevelSize;) {
+    size = image_kernels::mipSize(size);
+    bytes += levelBytes(size, compressed);
+  }
+  return bytes;
+}
+
+size_t TextureAtlas::levelBytes(int size, bool compressed) {
+  if (compressed)
+    return image_kernels::bc1Size(size, size);
+  return size_t(size) * size * 3;
+}
+
+TexRect TextureAtlas::slotRect(int slot) const {
+  // Inset by half a texel of the smallest level, so linear filtering does not pick up
+  // the neighbors on any level. That is 2^(maxLevel - 1) texels of the full level.
+  float inset = float(1 << maxLevel) / 2;
+  float x = float((slot % slotsPerRow) * slotSize);
+  float y = float((slot / slotsPerRow) * slotSize);
+  float size = float(pageSize);
+  return TexRect{(x + inset) / size, (y + inset) / size, (x + slotSize - inset) / size,
+                 (y + slotSize - inset) / size};
+}
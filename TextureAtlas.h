@@ -0,0 +1,62 @@
+#pragma once
+#include "Image.h"
+#include "utils.h"
+
+class TextureAtlas;
+
+/// One GL texture of an atlas, holding a grid of slots
+struct AtlasPage {
+  TextureAtlas& atlas;
+  GLTexture texture;
+  std::vector<int> freeSlots;
+  int used = 0;
+};
+
+/// Fixed-size storage for album cover textures.
+///
+/// Covers of the same size share large atlas pages, each slot holding one cover with
+/// its mip levels down to 8x8. The texture coordinates leave out a margin along the
+/// edges of each slot, so filtering never reaches the neighboring covers. Uploads go
+/// into existing storage with glTexSubImage2D, and evicting a cover only returns its
+/// slot to the free list. Textures are only created when all pages are full, and
+/// deleted when a page runs empty.
+class TextureAtlas {
+ public:
+  /// `slotSize` must be a power of two. Compressed atlases hold BC1 textures.
+  TextureAtlas(int slotSize, bool compressed);
+  NO_MOVE_NO_COPY(TextureAtlas);
+  ~TextureAtlas();
+
+  /// Copies `image` into a free slot. The image must be square with a side length of
+  /// `slotSize`, and compressed if the atlas is. The pixels are staged in a pixel
+  /// buffer object, so the driver can transfer them asynchronously.
+  GLImage upload(const UploadReadyImage& image);
+  int getSlotSize() const { return slotSize; };
+  int usedSlots() const;
+  size_t pageCount() const { return pages.size(); };
+  /// Video memory of all pages, including their free slots
+  size_t allocatedBytes() const { return pages.size() * pageBytes; };
+  /// Video memory taken up by one slot with all of its mip levels
+  static size_t slotBytes(int slotSize, bool compressed);
+
+ private:
+  friend class GLImage;
+  void release(AtlasPage& page, int slot);
+  AtlasPage& addPage();
+  TexRect slotRect(int slot) const;
+  static size_t levelBytes(int size, bool compressed);
+
+  int slotSize;
+  bool compressed;
+  int pageSize;
+  int slotsPerRow;
+  int maxLevel;
+  size_t pageBytes = 0;
+  std::vector<std::unique_ptr<AtlasPage>> pages;
+
+  // Ring of pixel unpack buffers, each big enough for a slot with all of its mip levels
+  static constexpr int uploadBufferCount = 4;
+  std::array<GLuint, uploadBufferCount> uploadBuffers{};
+  size_t uploadBufferSize = 0;
+  int nextUploadBuffer = 0;
+};
@@ -1,17 +1,63 @@
 #include "TextureCache.h"
 
+#include "ArtStats.h"
 #include "DbAlbumCollection.h"
 #include "EngineThread.h"
+#include "GLContext.h"
 #include "Image.h"
+#include "ThumbnailStore.h"
 #include "config.h"
 #include "cover_positions.h"
 #include "utils.h"
+#include "world_state.h"
+
+namespace {
+/// How far ahead we extrapolate a moving target, in seconds
+constexpr float predictionTime = 0.5f;
+/// With progressive loading, the load window reaches this many times the visible range
+/// beyond the full resolution range
+constexpr int proxyWindowScreens = 4;
+
+/// Loader threads exit after idling this long, down to their stage's minimum
+constexpr auto idleTimeout = std::chrono::seconds(10);
+/// A stage starts at most one thread per this many seconds
+constexpr double growInterval = 0.05;
+/// Fetches that spend less than this share of their time on the CPU wait for I/O, so
+/// more fetchers than cores help. Above cpuBoundShare they only add contention.
+constexpr float ioBoundShare = 0.5f;
+constexpr float cpuBoundShare = 0.8f;
+
+int coreCount() {
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+/// CPU time of the calling thread in seconds. Windows updates this once per scheduler
+/// tick, so single measurements are coarse, but averages are fine.
+double threadCpuTime() {
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0;
+  auto seconds = [](FILETIME t) {
+    return double(uint64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime) / 1e7;
+  };
+  return seconds(kernel) + seconds(user);
+}
+
+/// Compresses on the loader threads, so the engine thread only copies blocks
+void compressIfEnabled(UploadReadyImage& image) {
+  if (cfgTextureCompression && GLContext::supportsBC1())
+    image.compress();
+}
+}  // namespace
 
 TextureCache::TextureCache(EngineThread& thread, DbAlbumCollection& db,
-                           ScriptedCoverPositions& coverPos)
-    : db(db), thread(thread), coverPos(coverPos),
+                           ScriptedCoverPositions& coverPos, const WorldState& worldState)
+    : db(db), thread(thread), coverPos(coverPos), worldState(worldState),
       noCoverTexture(loadSpecialArt(IDR_COVER_NO_IMG, cfgImgNoCover.c_str()).upload()),
-      loadingTexture(loadSpecialArt(IDR_COVER_LOADING, cfgImgLoading.c_str()).upload()) {}
+      loadingTexture(loadSpecialArt(IDR_COVER_LOADING, cfgImgLoading.c_str()).upload()),
+      // Results can arrive after the last frame was drawn, e.g. full resolution
+      // upgrades of covers that already show their proxy
+      bgLoader([&thread] { thread.invalidateWindow(); }) {}
 
 void TextureCache::reloadSpecialTextures() {
   loadingTexture = loadSpecialArt(IDR_COVER_LOADING, cfgImgLoading.c_str()).upload();
@@ -23,7 +69,7 @@ const GLImage* TextureCache::getAlbumTexture(const std::string& albumName) {
   if (entry == textureCache.end())
     return nullptr;
   if (entry->texture) {
-    return &entry->texture.value();
+    return entry->texture.get();
   } else {
     return &noCoverTexture;
   }
@@ -34,54 +80,222 @@ GLImage& TextureCache::getLoadingTexture() {
 }
 
 void TextureCache::startLoading(const DBPos& target) {
-  cacheGeneration += 1;
-  // wrap around
-  if (cacheGeneration > std::numeric_limits<unsigned int>::max() - 100) {
-    cacheGeneration = 1;
-    for (auto it = textureCache.begin(); it != textureCache.end(); ++it) {
-      textureCache.modify(it, [&](CacheItem& x) { x.priority.first = 0; });
-    }
-  }
   if (auto iter = db.iterFromPos(target)) {
     updateLoadingQueue(iter.value());
   }
 }
 
 void TextureCache::onCollectionReload() {
+  // Only the albums whose art source changed are loaded again, see requestRange in
+  // updateLoadingQueue. The entries move on to the new version with their ranks, so
+  // trimCache keeps evicting by distance and leaves the load window alone. The new
+  // version only tells results that were requested before the reload apart.
   collectionVersion += 1;
+  for (auto item = textureCache.begin(); item != textureCache.end(); ++item) {
+    textureCache.modify(item, [&](CacheItem& x) {
+      x.collectionVersion = collectionVersion;
+      x.unverified = true;
+    });
+  }
   reloadSpecialTextures();
 }
 
-int TextureCache::maxCacheSize() {
+void TextureCache::onTracksModified(const metadb_handle_list& tracks) {
+  bool marked = false;
+  for (const auto& track : tracks) {
+    auto pos = db.getPosForTrack(track);
+    if (!pos)
+      continue;
+    auto cacheEntry = textureCache.find(pos->key);
+    if (cacheEntry == textureCache.end() || cacheEntry->unverified)
+      continue;
+    textureCache.modify(cacheEntry, [](CacheItem& x) { x.unverified = true; });
+    marked = true;
+  }
+  // Request the marked albums again, even if the collection did not change yet
+  if (marked)
+    loadWindow.reset();
+}
+
+size_t TextureCache::memoryBudget() {
+  return size_t(cfgTextureMemory.get_value()) << 20;
+}
+
+size_t TextureCache::budgetCount() {
+  // Assume every album has art, so this errs on the small side. With progressive
+  // loading, only the albums near the center cost a full resolution texture.
+  bool compressed = cfgTextureCompression && GLContext::supportsBC1();
+  size_t fullBytes = TextureAtlas::slotBytes(textureSize(TextureTier::full), compressed);
+  size_t proxyBytes =
+      TextureAtlas::slotBytes(textureSize(TextureTier::proxy), compressed);
+  size_t budget = memoryBudget();
+  size_t count = budget / fullBytes;
+  if (cfgProgressiveLoading) {
+    size_t fullCount = 2 * size_t(cfgFullResDistance.get_value()) + 1;
+    if (fullCount * fullBytes < budget)
+      count = fullCount + (budget - fullCount * fullBytes) / proxyBytes;
+  }
+  return count;
+}
+
+int TextureCache::maxLoadCount() {
+  size_t count = budgetCount();
+  // The budget fits thousands of proxies. Loading all of them would only delay the
+  // albums the user jumps to next, the rest of the budget keeps albums loaded earlier.
+  if (cfgProgressiveLoading) {
+    int visible = coverPos.getLastCover() - coverPos.getFirstCover() + 1;
+    int fullCount = 2 * cfgFullResDistance.get_value() + 1;
+    count = std::min(count, size_t(fullCount + proxyWindowScreens * visible));
+  }
+  // The visible covers are always loaded, even if they don't fit into the budget
   int maxDisplay = 1 + std::max(-coverPos.getFirstCover(), coverPos.getLastCover());
-  return std::min(db.size(), std::max(int(cfgTextureCacheSize), 2 * maxDisplay));
+  count = std::max(count, size_t(2 * maxDisplay));
+  return int(std::min(count, size_t(db.size())));
 }
 
 void TextureCache::trimCache() {
-  while (textureCache.size() > static_cast<size_t>(maxCacheSize())) {
-    auto& prorityIndex = textureCache.get<1>();
-    auto oldestEntry = prorityIndex.begin();
-    prorityIndex.erase(oldestEntry);
+  // Results waiting for upload are about to enter the cache, make room for them too.
+  // Albums without art take up no memory, but we don't keep them around forever.
+  size_t budget = memoryBudget();
+  size_t pending = bgLoader.getStats().loadedBytes;
+  size_t maxEntries = 2 * std::max(budgetCount(), size_t(maxLoadCount()));
+  int center = loadWindow ? loadWindow->center : 0;
+  auto overBudget = [&] {
+    return cacheBytes + pending > budget || textureCache.size() > maxEntries;
+  };
+  // Albums in the load window would only be requested again, including the ones that
+  // wait for the loader to check their art source. If these alone exceed the budget,
+  // the visible covers need it.
+  auto inWindow = [&](const CacheItem& item) {
+    return loadWindow && item.rank >= loadWindow->first && item.rank <= loadWindow->last;
+  };
+  IF_DEBUG(auto windowCount = [&] {
+    return std::count_if(textureCache.begin(), textureCache.end(), inWindow);
+  });
+  IF_DEBUG(auto windowBefore = windowCount());
+
+  auto& rankIndex = textureCache.get<1>();
+  // Entries from old collection versions sort first, evict those before anything else
+  auto current = rankIndex.lower_bound(std::make_tuple(collectionVersion));
+  for (auto item = rankIndex.begin(); item != current && overBudget();) {
+    if (inWindow(*item)) {
+      ++item;
+      continue;
+    }
+    releaseTexture(*item);
+    item = rankIndex.erase(item);
   }
+  // Otherwise evict whichever end is further away from the center. On ties, prefer
+  // the left side, as the loading window extends further to the right.
+  while (overBudget()) {
+    auto first = rankIndex.lower_bound(std::make_tuple(collectionVersion));
+    if (first == rankIndex.end())
+      break;
+    auto last = std::prev(rankIndex.end());
+    auto victim = first;
+    if (std::abs(first->rank - center) < std::abs(last->rank - center))
+      victim = last;
+    if (inWindow(*victim))
+      break;
+    releaseTexture(*victim);
+    rankIndex.erase(victim);
+  }
+  // Neither a full budget nor a collection reload takes covers from the load window
+  IF_DEBUG(PFC_ASSERT(windowCount() == windowBefore));
 }
 
 void TextureCache::clearCache() {
   textureCache.clear();
+  sharedTextures.clear();
+  cacheBytes = 0;
+  atlases.clear();
+  loadWindow.reset();
   glFlush();
   bgLoader.flushQueue();
+  BufferPool::trim();
 }
 
 void TextureCache::uploadTextures() {
+  // Spread the uploads over several frames when a lot of textures arrive at once, e.g.
+  // after a jump. We always upload at least one texture to guarantee progress.
+  double deadline = time() + cfgUploadBudget / 1000.0;
   while (auto loaded = bgLoader.getLoaded()) {
-    auto existing = textureCache.find(loaded->meta.groupString);
+    auto existing = textureCache.find(loaded->groupString);
+    if (loaded->unchanged) {
+      // Keeps the texture. If it was evicted meanwhile, the album is requested again.
+      // Answers to requests from before a reload don't count for the new version.
+      if (existing != textureCache.end() &&
+          existing->artSource == loaded->artSource &&
+          existing->collectionVersion <= loaded->collectionVersion &&
+          (existing->unverified ||
+           existing->collectionVersion < loaded->collectionVersion)) {
+        textureCache.modify(existing, [&](CacheItem& x) {
+          x.collectionVersion = loaded->collectionVersion;
+          x.rank = loaded->rank;
+          x.unverified = false;
+        });
+      }
+      continue;
+    }
     if (existing != textureCache.end()) {
+      // Proxies can finish after the full resolution texture, don't downgrade. Textures
+      // that wait for the check of their art source take any result of their version.
+      if (existing->collectionVersion > loaded->collectionVersion ||
+          (!existing->unverified &&
+           std::tie(existing->collectionVersion, existing->tier) >
+               std::tie(loaded->collectionVersion, loaded->tier)))
+        continue;
+      releaseTexture(*existing);
       textureCache.erase(existing);
     }
-    std::optional<GLImage> texture{};
-    if (loaded->image)
-      texture = loaded->image->upload();
-    textureCache.emplace(loaded->meta, std::move(texture));
+    std::shared_ptr<const GLImage> texture{};
+    if (loaded->image) {
+      texture = sharedTexture(loaded.value());
+    } else {
+      // There is no art that could be upgraded
+      loaded->tier = TextureTier::full;
+    }
+    textureCache.emplace(*loaded, std::move(texture), loaded->contentKey);
+    if (time() > deadline)
+      break;
+  }
+}
+
+bool TextureCache::hasPendingUploads() {
+  return bgLoader.hasLoaded();
+}
+
+std::shared_ptr<const GLImage> TextureCache::sharedTexture(
+    const TextureLoadingThreads::LoadResponse& loaded) {
+  if (loaded.contentKey != 0) {
+    if (auto texture = sharedTextures[loaded.contentKey].lock())
+      return texture;
   }
+  std::shared_ptr<const GLImage> texture =
+      std::make_shared<GLImage>(upload(*loaded.image));
+  cacheBytes += texture->getMemorySize();
+  if (loaded.contentKey != 0)
+    sharedTextures[loaded.contentKey] = texture;
+  return texture;
+}
+
+void TextureCache::releaseTexture(const CacheItem& item) {
+  // Other albums with the same art keep the texture alive
+  if (!item.texture || item.texture.use_count() > 1)
+    return;
+  cacheBytes -= item.texture->getMemorySize();
+  if (item.contentKey != 0)
+    sharedTextures.erase(item.contentKey);
+}
+
+GLImage TextureCache::upload(const UploadReadyImage& image) {
+  int size = image.getImage().width;
+  bool compressed = image.isCompressed();
+  auto atlas = atlases.try_emplace({size, compressed}, size, compressed).first;
+  double preUpload = time();
+  GLImage texture = atlas->second.upload(image);
+  ArtStats::record(ArtStats::Stage::upload, time() - preUpload);
+  return texture;
 }
 
 void TextureCache::pauseLoading() {
@@ -96,94 +310,475 @@ void TextureCache::setPriority(bool highPriority) {
   bgLoader.setPriority(highPriority);
 }
 
+TextureLoadingThreads::Stats TextureCache::getLoaderStats() {
+  return bgLoader.getStats();
+}
+
+TextureCache::MemoryUsage TextureCache::getMemoryUsage() {
+  size_t atlasBytes = 0;
+  for (auto& [key, atlas] : atlases) {
+    atlasBytes += atlas.allocatedBytes();
+  }
+  auto loader = bgLoader.getStats();
+  return MemoryUsage{cacheBytes, atlasBytes, memoryBudget(), loader.loadedBytes,
+                     loader.pipelineBytes};
+}
+
+std::pair<int, int> TextureCache::passedRange(int from, int to) {
+  if (cfgMinDwellTime <= 0 || from == to)
+    return {0, -1};
+  // An album is on screen while the animation moves through the visible range. Far
+  // away from the target, the animation is fast and the album gone again quickly.
+  int visibleFirst = coverPos.getFirstCover();
+  int visibleLast = coverPos.getLastCover();
+  float visibleCount = float(visibleLast - visibleFirst + 1);
+  float minDwell = float(cfgMinDwellTime) / 1000;
+  int dwellDistance = 0;
+  while (dwellDistance < std::abs(to - from) &&
+         visibleCount / WorldState::moveSpeed(float(dwellDistance)) >= minDwell) {
+    dwellDistance++;
+  }
+  // Never skip what is on screen right now, or around the target
+  if (to > from)
+    return {from + visibleLast + 1, to - std::max(dwellDistance, -visibleFirst) - 1};
+  return {to + std::max(dwellDistance, visibleLast) + 1, from + visibleFirst - 1};
+}
+
+bool TextureCache::hasDeferredLoads() const {
+  return loadWindow && loadWindow->deferFirst <= loadWindow->deferLast;
+}
+
+bool TextureCache::isLoadingAhead() const {
+  return loadWindow && loadWindow->stop != loadWindow->center;
+}
+
 void TextureCache::updateLoadingQueue(const DBIter& queueCenter) {
-  // Update loaded textures from background loader
+  // Update loaded textures from background loader. Results that did not fit into the
+  // upload budget are matched up with the new requests by the loader.
   // There is a race here: if a loader finishes loading an image between this call
   // and the call to setQueue below, we might load that image twice.
   uploadTextures();
-  size_t maxLoad = maxCacheSize();
 
-  std::vector<TextureLoadingThreads::LoadRequest> requests;
+  int maxLoad = maxLoadCount();
+  int center = db.difference(queueCenter, db.begin());
+  int centered = center;
+  if (auto iter = db.iterFromPos(worldState.getCenteredPos()))
+    centered = db.difference(iter.value(), db.begin());
 
-  DBIter leftLoaded = queueCenter;
-  DBIter rightLoaded = queueCenter;
-  DBIter loadNext = queueCenter;
+  // While the target keeps moving, assume it moves on for a bit. The window reaches
+  // further in the direction of travel, and the loader starts at the predicted stop.
+  // Once the animation has settled, the queue is centered on the target again.
+  float velocity = worldState.isMoving() ? worldState.getTargetVelocity() : 0.0f;
+  int stop = center + int(velocity * predictionTime);
+  int shift = std::clamp(stop - center, -(maxLoad - 1) / 4, (maxLoad - 1) / 4);
+  // The window extends one album further to the right if maxLoad is even, and is
+  // shifted inwards at the ends of the collection
+  int first = std::max(0, center + shift - (maxLoad - 1) / 2);
+  int last = std::min(db.size() - 1, first + maxLoad - 1);
+  first = std::max(0, last - maxLoad + 1);
+  stop = std::clamp(stop, first, last);
+  // Albums near the center are loaded in full resolution, the rest of the window only
+  // gets proxies. Without progressive loading, the whole window is loaded in full.
+  int fullDistance = cfgProgressiveLoading ? int(cfgFullResDistance) : maxLoad;
+  // The albums the animation rushes past on its way to the target are deferred until
+  // it has settled
+  auto [deferFirst, deferLast] = passedRange(centered, center);
+  LoadWindow window{first,
+                    last,
+                    std::max(first, center - fullDistance),
+                    std::min(last, center + fullDistance),
+                    center,
+                    stop,
+                    deferFirst,
+                    deferLast,
+                    db.version(),
+                    collectionVersion};
 
-  for (size_t i = 0; i < maxLoad; i++) {
-    auto cacheEntry = textureCache.find(loadNext->key);
-    auto priority = std::make_pair(cacheGeneration, -static_cast<int>(i));
-    if (cacheEntry != textureCache.end() &&
-        cacheEntry->collectionVersion == collectionVersion) {
-      textureCache.modify(cacheEntry, [=](CacheItem& x) { x.priority = priority; });
-    } else {
+  std::vector<TextureLoadingThreads::LoadRequest> requests;
+  // Requests all albums in [first, last] that are not cached in at least `tier`
+  auto requestRange = [&](int first, int last, TextureTier tier) {
+    if (first > last)
+      return;
+    DBIter album = db.moveIterBy(queueCenter, first - center);
+    for (int rank = first; rank <= last; ++rank, ++album) {
+      if (rank >= window.deferFirst && rank <= window.deferLast)
+        continue;
+      auto cacheEntry = textureCache.find(album->key);
+      t_uint64 cachedSource = 0;
+      if (cacheEntry != textureCache.end()) {
+        bool current = cacheEntry->collectionVersion == collectionVersion;
+        if (current)
+          textureCache.modify(cacheEntry, [=](CacheItem& x) { x.rank = rank; });
+        if (current && !cacheEntry->unverified) {
+          if (cacheEntry->tier >= tier)
+            continue;
+        } else if (cacheEntry->tier >= tier) {
+          // Keep the texture unless its art source changed
+          cachedSource = cacheEntry->artSource;
+        }
+      }
       // We only consider one track for art extraction for performance reasons
-      requests.emplace_back(TextureLoadingThreads::LoadRequest{
-          TextureCacheMeta{loadNext->key, collectionVersion, priority},
-          loadNext->tracks[0]});
+      requests.push_back(TextureLoadingThreads::LoadRequest{
+          {album->key, collectionVersion, rank, tier}, album->tracks[0], cachedSource});
     }
+  };
+  auto requestProxies = [&](int first, int last) {
+    if (cfgProgressiveLoading)
+      requestRange(std::max(first, window.first), std::min(last, window.last),
+                   TextureTier::proxy);
+  };
+  auto requestFull = [&](int first, int last) {
+    requestRange(std::max(first, window.fullFirst), std::min(last, window.fullLast),
+                 TextureTier::full);
+  };
 
-    if (i == maxLoad - 1)
-      break;
-    if ((((i % 2) != 0u) || leftLoaded == db.begin()) &&
-        ++DBIter(rightLoaded) != db.end()) {
-      ++rightLoaded;
-      loadNext = rightLoaded;
-      PFC_ASSERT(loadNext != db.end());
-    } else {
-      PFC_ASSERT(leftLoaded != db.begin());
-      --leftLoaded;
-      loadNext = leftLoaded;
-    }
-  }
+  if (!loadWindow || loadWindow->dbVersion != window.dbVersion ||
+      loadWindow->collectionVersion != window.collectionVersion) {
+    // Album ranks might have changed, start from scratch
+    requestProxies(window.first, window.last);
+    requestFull(window.fullFirst, window.fullLast);
+    bgLoader.setQueue(stop, std::move(requests));
+  } else {
+    // Only touch the albums that entered or left the window, the full resolution
+    // range or the deferred range. `difference` calls `fn` with the parts of
+    // [first, last] that are not in [otherFirst, otherLast].
+    auto difference = [](int first, int last, int otherFirst, int otherLast, auto&& fn) {
+      if (int end = std::min(last, otherFirst - 1); first <= end)
+        fn(first, end);
+      if (int begin = std::max(first, otherLast + 1); begin <= last)
+        fn(begin, last);
+    };
+    const LoadWindow& old = loadWindow.value();
+    difference(window.first, window.last, old.first, old.last, requestProxies);
+    difference(window.fullFirst, window.fullLast, old.fullFirst, old.fullLast,
+               requestFull);
+    difference(old.deferFirst, old.deferLast, window.deferFirst, window.deferLast,
+               [&](int first, int last) {
+                 requestProxies(first, last);
+                 requestFull(first, last);
+               });
 
-  bgLoader.setQueue(std::move(requests));
+    std::vector<TextureLoadingThreads::DropRange> dropped;
+    difference(old.first, old.last, window.first, window.last, [&](int first, int last) {
+      dropped.push_back({TextureTier::proxy, first, last});
+    });
+    difference(old.fullFirst, old.fullLast, window.fullFirst, window.fullLast,
+               [&](int first, int last) {
+                 dropped.push_back({TextureTier::full, first, last});
+               });
+    difference(window.deferFirst, window.deferLast, old.deferFirst, old.deferLast,
+               [&](int first, int last) {
+                 dropped.push_back({TextureTier::proxy, first, last});
+               });
+    bgLoader.updateQueue(stop, dropped, std::move(requests));
+  }
+  loadWindow = window;
 }
 
-TextureLoadingThreads::TextureLoadingThreads() {
-  unsigned int threadCount = std::thread::hardware_concurrency();
-  for (unsigned int i = 0; i < threadCount; i++) {
-    threads.emplace_back(catchThreadExceptions("TextureLoader", [&] { this->run(); }));
-    check(
-        SetThreadPriority(threads.back().native_handle(), THREAD_PRIORITY_BELOW_NORMAL));
-    // Disable dynamic priority boost. We don't want the texture loaders to ever have
-    // higher priority than the engine thread.
-    check(SetThreadPriorityBoost(threads.back().native_handle(), TRUE));
+TextureLoadingThreads::TextureLoadingThreads(std::function<void()> onLoaded)
+    : onLoaded(std::move(onLoaded)),
+      fetchPool{"TextureFetcher", &TextureLoadingThreads::runFetch, 2,
+                std::clamp(4 * coreCount(), 8, 64)},
+      decodePool{"TextureDecoder", &TextureLoadingThreads::runDecode, 1, coreCount()},
+      resizePool{"TextureResizer", &TextureLoadingThreads::runResize, 1, coreCount()},
+      decodeQueue(2 * decodePool.maxThreads), resizeQueue(2 * resizePool.maxThreads) {
+  // Fetching mostly waits for I/O, so the fetchers may outnumber the cores while that
+  // is the case. The bounded queues stop the fetchers from running far ahead of
+  // decoding.
+  {
+    std::scoped_lock lock{mutex};
+    for (auto* pool : {&fetchPool, &decodePool, &resizePool}) {
+      for (int i = 0; i < pool->minThreads; i++) spawnWorker(*pool);
+    }
   }
   setPriority(true);
 }
 
+void TextureLoadingThreads::spawnWorker(StagePool& pool) {
+  for (auto id : finishedThreads) {
+    threads.extract(id).mapped().join();
+  }
+  finishedThreads.clear();
+  pool.running++;
+  pool.lastSpawn = time();
+  std::thread thread{catchThreadExceptions(pool.name, [this, &pool] {
+    (this->*pool.run)();
+    // Only reached when the thread retires or the loader shuts down
+    BufferPool::releaseThreadCache();
+    std::scoped_lock lock{mutex};
+    finishedThreads.push_back(std::this_thread::get_id());
+  })};
+  check(SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL));
+  // Disable dynamic priority boost. We don't want the texture loaders to ever have
+  // higher priority than the engine thread.
+  check(SetThreadPriorityBoost(thread.native_handle(), TRUE));
+  threads.emplace(thread.get_id(), std::move(thread));
+}
+
+void TextureLoadingThreads::growStage(StagePool& pool, size_t queued) {
+  std::scoped_lock lock{mutex};
+  if (abort.is_aborting() || queued == 0 || pool.running >= pool.maxThreads ||
+      pool.busy < pool.running || time() - pool.lastSpawn < growInterval)
+    return;
+  spawnWorker(pool);
+}
+
+void TextureLoadingThreads::growFetchers() {
+  if (abort.is_aborting() || fetchPool.running >= fetchPool.maxThreads ||
+      fetchPool.busy < fetchPool.running || inQueue.size() < size_t(fetchPool.running))
+    return;
+  if (fetchCpuShare > ioBoundShare && fetchPool.running >= coreCount())
+    return;
+  if (time() - fetchPool.lastSpawn < growInterval)
+    return;
+  spawnWorker(fetchPool);
+}
+
+bool TextureLoadingThreads::retire(StagePool& pool) {
+  if (pool.running <= pool.minThreads)
+    return false;
+  pool.running--;
+  return true;
+}
+
+bool TextureLoadingThreads::recordFetch(double seconds, double cpuSeconds) {
+  std::scoped_lock lock{mutex};
+  // Moving average over roughly the last 20 fetches
+  float share = seconds > 0 ? float(std::min(1.0, cpuSeconds / seconds)) : 1.0f;
+  fetchCpuShare += (share - fetchCpuShare) / 20;
+  if (fetchCpuShare > cpuBoundShare && fetchPool.running > coreCount())
+    return retire(fetchPool);
+  growFetchers();
+  return false;
+}
+
 TextureLoadingThreads::~TextureLoadingThreads() {
-  abort.set();
+  std::map<std::thread::id, std::thread> remaining;
+  {
+    std::scoped_lock lock{mutex};
+    // No thread is started once abort is set
+    abort.set();
+    for (auto& [key, job] : inProgress) {
+      job.abort->set();
+    }
+    remaining.swap(threads);
+  }
   resume();
   inCondition.notify_all();
-  for (auto& thread : threads) {
+  decodeQueue.close();
+  resizeQueue.close();
+  for (auto& [id, thread] : remaining) {
     if (thread.joinable()) {
       thread.join();
     }
   }
 }
 
-void TextureLoadingThreads::run() {
+void TextureLoadingThreads::waitUntilResumed() {
+  abort.check();
+  pauseMutex.lock_shared();
+  pauseMutex.unlock_shared();
+  abort.check();
+}
+
+void TextureLoadingThreads::updateBackgroundMode(bool& inBackground) {
+  bool shouldBackground = !highPriority.load(std::memory_order_relaxed);
+  if (shouldBackground != inBackground) {
+    check(SetThreadPriority(GetCurrentThread(), shouldBackground
+                                                    ? THREAD_MODE_BACKGROUND_BEGIN
+                                                    : THREAD_MODE_BACKGROUND_END));
+    inBackground = shouldBackground;
+  }
+}
+
+void TextureLoadingThreads::runFetch() {
+  bool inBackground = false;
+  bool retiring = false;
+  while (!retiring) {
+    waitUntilResumed();
+    auto taken = takeJob();
+    if (!taken)
+      return;
+    LoadRequest& job = taken->request;
+    JobAbort& jobAbort = taken->abort;
+    auto _ = gsl::finally([&] { fetchPool.busy--; });
+    abort.check();
+    updateBackgroundMode(inBackground);
+
+    double fetchStart = time();
+    double cpuStart = threadCpuTime();
+    auto& store = ThumbnailStore::instance();
+    t_uint64 fingerprint = artSourceFingerprint(job.track);
+    if (checkArtSource(job.groupString, job.tier, jobAbort, fingerprint)) {
+      ArtStats::count(ArtStats::Outcome::unchanged);
+      continue;
+    }
+    if (auto stored = store.get(job.groupString, fingerprint, job.tier)) {
+      ArtStats::count(ArtStats::Outcome::cached);
+      compressIfEnabled(stored->image);
+      finishJob(job.groupString, job.tier, jobAbort,
+                std::make_shared<UploadReadyImage>(std::move(stored->image)),
+                stored->contentKey);
+      continue;
+    }
+    if (store.isMissing(job.groupString, fingerprint)) {
+      ArtStats::count(ArtStats::Outcome::knownMissing);
+      finishJob(job.groupString, job.tier, jobAbort, nullptr);
+      continue;
+    }
+    FetchedArt fetched;
+    try {
+      fetched = fetchAlbumArt(job.track, *jobAbort);
+    } catch (const exception_aborted&) {
+      abort.check();
+      dropJob(job.groupString, job.tier, jobAbort);
+      continue;
+    }
+    retiring = recordFetch(time() - fetchStart, threadCpuTime() - cpuStart);
+    if (fetched.missing)
+      store.putMissing(job.groupString, fingerprint);
+    album_art_data::ptr art = std::move(fetched.data);
+    if (art.is_empty()) {
+      finishJob(job.groupString, job.tier, jobAbort, nullptr);
+      continue;
+    }
+
+    // Multi-disc sets, compilations and placeholder images often share their art
+    t_uint64 contentKey =
+        ThumbnailStore::contentKey(art->get_ptr(), art->get_size(), job.tier);
+    if (auto shared =
+            store.getShared(job.groupString, fingerprint, job.tier, contentKey)) {
+      ArtStats::count(ArtStats::Outcome::cached);
+      compressIfEnabled(shared.value());
+      finishJob(job.groupString, job.tier, jobAbort,
+                std::make_shared<UploadReadyImage>(std::move(shared.value())),
+                contentKey);
+      continue;
+    }
+    {
+      std::scoped_lock lock{mutex};
+      auto running = inProgress.find({job.groupString, job.tier});
+      if (running == inProgress.end() || running->second.abort != jobAbort)
+        continue;  // cancelled
+      auto [sharedJob, isNew] = sharedJobs.try_emplace(contentKey);
+      if (!isNew) {
+        sharedJob->second.emplace_back(job.groupString, jobAbort);
+        running->second.waiting = true;
+        continue;
+      }
+    }
+    size_t artBytes = art->get_size();
+    pipelineBytes += artBytes;
+    growStage(decodePool, decodeQueue.size() + 1);
+    if (!decodeQueue.push(PipelineJob{job.groupString, job.tier, jobAbort, fingerprint,
+                                      contentKey, std::move(art), {}, artBytes}))
+      return;
+  }
+}
+
+void TextureLoadingThreads::runDecode() {
+  // The scaled JPEG decoder uses WIC
+  CoInitializeScope com_enable{};
   bool inBackground = false;
   for (;;) {
-    abort.check();
-    pauseMutex.lock_shared();
-    pauseMutex.unlock_shared();
-    abort.check();
-    auto [jobId, track] = takeJob();
-    abort.check();
+    waitUntilResumed();
+    auto job = decodeQueue.popFor(idleTimeout);
+    if (!job) {
+      if (decodeQueue.closed())
+        return;
+      // Idle threads don't hold on to buffers the busy ones could use
+      BufferPool::releaseThreadCache();
+      std::scoped_lock lock{mutex};
+      if (retire(decodePool))
+        return;
+      continue;
+    }
+    updateBackgroundMode(inBackground);
+
+    decodePool.busy++;
+    auto _ = gsl::finally([&] { decodePool.busy--; });
+    auto drop = [&] {
+      pipelineBytes -= job->bytes;
+      dropJob(job->id, job->tier, job->abort, job->contentKey);
+    };
+    if (job->abort->is_aborting()) {
+      drop();
+      continue;
+    }
+    double preDecode = time();
+    try {
+      job->image.emplace(Image::fromFileBufferScaled(
+          job->art->get_ptr(), job->art->get_size(), maxTextureSize(job->tier),
+          *job->abort));
+    } catch (const exception_aborted&) {
+      abort.check();
+      drop();
+      continue;
+    } catch (const std::exception&) {
+      IF_DEBUG(console::out() << "ART [fail] decode");
+      ArtStats::count(ArtStats::Outcome::undecodable);
+      pipelineBytes -= job->bytes;
+      finishJob(job->id, job->tier, job->abort, nullptr, job->contentKey);
+      continue;
+    }
+    ArtStats::record(ArtStats::Stage::decode, time() - preDecode);
+    job->art.release();
+    size_t imageBytes = size_t(job->image->width) * job->image->height * 3;
+    pipelineBytes += imageBytes;
+    pipelineBytes -= std::exchange(job->bytes, imageBytes);
+    growStage(resizePool, resizeQueue.size() + 1);
+    if (!resizeQueue.push(std::move(job.value())))
+      return;
+  }
+}
 
-    bool shouldBackground = !highPriority.load(std::memory_order_relaxed);
-    if (shouldBackground != inBackground) {
-      check(SetThreadPriority(GetCurrentThread(), shouldBackground
-                                                      ? THREAD_MODE_BACKGROUND_BEGIN
-                                                      : THREAD_MODE_BACKGROUND_END));
-      inBackground = shouldBackground;
+void TextureLoadingThreads::runResize() {
+  bool inBackground = false;
+  for (;;) {
+    waitUntilResumed();
+    auto job = resizeQueue.popFor(idleTimeout);
+    if (!job) {
+      if (resizeQueue.closed())
+        return;
+      BufferPool::releaseThreadCache();
+      std::scoped_lock lock{mutex};
+      if (retire(resizePool))
+        return;
+      continue;
     }
+    updateBackgroundMode(inBackground);
 
-    auto art = loadAlbumArt(track, abort);
+    resizePool.busy++;
+    auto _ = gsl::finally([&] {
+      resizePool.busy--;
+      pipelineBytes -= job->bytes;
+    });
+    if (job->abort->is_aborting()) {
+      dropJob(job->id, job->tier, job->abort, job->contentKey);
+      continue;
+    }
+    std::optional<UploadReadyImage> image;
+    double preResize = time();
+    try {
+      image.emplace(std::move(job->image.value()), job->tier);
+    } catch (const std::exception&) {
+      IF_DEBUG(console::out() << "ART [fail] resize");
+      ArtStats::count(ArtStats::Outcome::failed);
+      finishJob(job->id, job->tier, job->abort, nullptr, job->contentKey);
+      continue;
+    }
+    ArtStats::record(ArtStats::Stage::resize, time() - preResize);
     abort.check();
-    finishJob(jobId, std::move(art));
+    // Stored even if cancelled by now, the album is likely to come back
+    ThumbnailStore::instance().put(job->id, job->fingerprint, job->tier, job->contentKey,
+                                   image.value());
+    if (job->abort->is_aborting()) {
+      dropJob(job->id, job->tier, job->abort, job->contentKey);
+      continue;
+    }
+    compressIfEnabled(image.value());
+    finishJob(job->id, job->tier, job->abort,
+              std::make_shared<UploadReadyImage>(std::move(*image)), job->contentKey);
   }
 }
 
@@ -191,11 +786,39 @@ std::optional<TextureLoadingThreads::LoadResponse> TextureLoadingThreads::getLoa
   std::scoped_lock lock{mutex};
   if (outQueue.empty())
     return std::nullopt;
-  auto rc = std::make_optional(std::move(outQueue.back()));
-  outQueue.pop_back();
+  // Whatever is closest to the center first, on ties the proxies
+  return takeLoaded(outQueue.project<0>(mostImportant(outQueue.get<1>())));
+}
+
+void TextureLoadingThreads::pushLoaded(LoadResponse&& response) {
+  // Results of older collection versions are superseded
+  auto existing = outQueue.find(std::make_tuple(response.groupString, response.tier));
+  if (existing != outQueue.end())
+    takeLoaded(existing);
+  if (response.image && outQueueImages[response.image.get()]++ == 0)
+    outQueueBytes += response.image->memorySize();
+  outQueue.insert(std::move(response));
+}
+
+TextureLoadingThreads::LoadResponse TextureLoadingThreads::takeLoaded(
+    t_outQueue::iterator loaded) {
+  LoadResponse rc = *loaded;
+  outQueue.erase(loaded);
+  if (rc.image) {
+    auto image = outQueueImages.find(rc.image.get());
+    if (--image->second == 0) {
+      outQueueImages.erase(image);
+      outQueueBytes -= rc.image->memorySize();
+    }
+  }
   return rc;
 }
 
+bool TextureLoadingThreads::hasLoaded() {
+  std::scoped_lock lock{mutex};
+  return !outQueue.empty();
+}
+
 void TextureLoadingThreads::pause() {
   if (!pauseLock.owns_lock())
     pauseLock.lock();
@@ -210,40 +833,255 @@ void TextureLoadingThreads::setPriority(bool highPriority) {
   this->highPriority.store(highPriority, std::memory_order_relaxed);
 }
 
+TextureLoadingThreads::Stats TextureLoadingThreads::getStats() {
+  std::scoped_lock lock{mutex};
+  return Stats{inQueue.size(),
+               fetchPool.busy,
+               fetchPool.running,
+               fetchPool.maxThreads,
+               fetchCpuShare,
+               decodeQueue.size(),
+               decodePool.busy,
+               decodePool.running,
+               resizeQueue.size(),
+               resizePool.busy,
+               resizePool.running,
+               outQueue.size(),
+               outQueueBytes,
+               pipelineBytes,
+               cancelled,
+               preempted};
+}
+
 void TextureLoadingThreads::flushQueue() {
   std::scoped_lock lock{mutex};
   inQueue.clear();
 }
 
-void TextureLoadingThreads::setQueue(std::vector<LoadRequest>&& data) {
+void TextureLoadingThreads::enqueue(LoadRequest&& request) {
+  auto workItem = inProgress.find({request.groupString, request.tier});
+  if (workItem != inProgress.end()) {
+    request.artSource = workItem->second.request.artSource;
+    workItem->second.request = std::move(request);
+    return;
+  }
+  // Uploads are spread over several frames, so the result might be waiting already
+  auto loaded = outQueue.find(std::make_tuple(request.groupString, request.tier));
+  if (loaded != outQueue.end() &&
+      loaded->collectionVersion == request.collectionVersion) {
+    outQueue.modify(loaded, [&](LoadResponse& x) { x.rank = request.rank; });
+    return;
+  }
+  auto queued = inQueue.find(std::make_tuple(request.groupString, request.tier));
+  if (queued != inQueue.end()) {
+    request.queuedAt = queued->queuedAt;
+    inQueue.replace(queued, std::move(request));
+  } else {
+    request.queuedAt = time();
+    inQueue.insert(std::move(request));
+  }
+}
+
+bool TextureLoadingThreads::checkArtSource(const std::string& id, TextureTier tier,
+                                           const JobAbort& jobAbort, t_uint64 artSource) {
+  bool wake = false;
+  {
+    std::scoped_lock lock{mutex};
+    auto job = inProgress.find({id, tier});
+    if (job == inProgress.end() || job->second.abort != jobAbort)
+      return false;  // cancelled, the next check drops it
+    LoadRequest& request = job->second.request;
+    request.artSource = artSource;
+    if (request.cachedSource == 0 || request.cachedSource != artSource)
+      return false;
+    wake = outQueue.empty();
+    pushLoaded(LoadResponse{std::move(request), nullptr, 0, true});
+    inProgress.erase(job);
+  }
+  if (wake)
+    onLoaded();
+  return true;
+}
+
+void TextureLoadingThreads::setQueue(int center, std::vector<LoadRequest>&& data) {
   {
     std::scoped_lock lock{mutex};
     inQueue.clear();
+    queueCenter = center;
+    std::set<std::pair<std::string, TextureTier>> wanted;
+    for (auto& e : data) {
+      wanted.emplace(e.groupString, e.tier);
+    }
+    for (auto job = inProgress.begin(); job != inProgress.end();) {
+      auto current = job++;
+      if (!wanted.count(current->first))
+        cancel(current, false);
+    }
     for (auto&& e : data) {
-      auto workItem = inProgress.find(e.meta.groupString);
-      if (workItem != inProgress.end()) {
-        workItem->second = std::move(e.meta);
-      } else {
-        inQueue.push_back(std::move(e));
-      }
+      enqueue(std::move(e));
     }
+    growFetchers();
+    preempt();
   }
   inCondition.notify_all();
 }
 
-std::pair<std::string, metadb_handle_ptr> TextureLoadingThreads::takeJob() {
+void TextureLoadingThreads::updateQueue(int center,
+                                        const std::vector<DropRange>& dropped,
+                                        std::vector<LoadRequest>&& added) {
+  {
+    std::scoped_lock lock{mutex};
+    queueCenter = center;
+    auto& rankIndex = inQueue.get<1>();
+    for (auto [minTier, first, last] : dropped) {
+      for (auto tier : {TextureTier::proxy, TextureTier::full}) {
+        if (tier < minTier)
+          continue;
+        rankIndex.erase(rankIndex.lower_bound(std::make_tuple(tier, first)),
+                        rankIndex.upper_bound(std::make_tuple(tier, last)));
+      }
+      for (auto job = inProgress.begin(); job != inProgress.end();) {
+        auto current = job++;
+        const LoadRequest& request = current->second.request;
+        if (request.tier >= minTier && request.rank >= first && request.rank <= last)
+          cancel(current, false);
+      }
+    }
+    for (auto&& e : added) {
+      enqueue(std::move(e));
+    }
+    growFetchers();
+    preempt();
+  }
+  if (!added.empty())
+    inCondition.notify_all();
+}
+
+std::pair<int, TextureTier> TextureLoadingThreads::importance(
+    const TextureCacheMeta& entry) const {
+  // Full resolution is only requested near the center, so these requests compete with
+  // the proxies there instead of waiting for all of them
+  return std::make_pair(std::abs(entry.rank - queueCenter), entry.tier);
+}
+
+template <class RankIndex>
+typename RankIndex::iterator TextureLoadingThreads::mostImportant(RankIndex& rankIndex) {
+  // Pick the entry closest to the center in each tier, ties go to the right. Then pick
+  // the more important of these.
+  auto best = rankIndex.end();
+  for (auto tier : {TextureTier::proxy, TextureTier::full}) {
+    auto tierBegin = rankIndex.lower_bound(std::make_tuple(tier));
+    auto tierEnd = rankIndex.upper_bound(std::make_tuple(tier));
+    if (tierBegin == tierEnd)
+      continue;
+    auto entry = rankIndex.lower_bound(std::make_tuple(tier, queueCenter));
+    if (entry == tierEnd || (entry != tierBegin && queueCenter - std::prev(entry)->rank <
+                                                       entry->rank - queueCenter)) {
+      --entry;
+    }
+    if (best == rankIndex.end() || importance(*entry) < importance(*best))
+      best = entry;
+  }
+  return best;
+}
+
+std::optional<TextureLoadingThreads::RunningJob> TextureLoadingThreads::takeJob() {
   std::unique_lock lock{mutex};
-  inCondition.wait(lock, [&] { return abort.is_aborting() || !inQueue.empty(); });
+  while (!inCondition.wait_for(lock, idleTimeout, [&] {
+    return abort.is_aborting() || !inQueue.empty();
+  })) {
+    BufferPool::releaseThreadCache();
+    if (retire(fetchPool))
+      return std::nullopt;
+  }
   abort.check();
-  LoadRequest rc(std::move(inQueue.front()));
-  inQueue.pop_front();
-  inProgress[rc.meta.groupString] = rc.meta;
-  return {rc.meta.groupString, rc.track};
+  auto& rankIndex = inQueue.get<1>();
+  auto job = mostImportant(rankIndex);
+  RunningJob rc{*job, std::make_shared<abort_callback_impl>()};
+  rankIndex.erase(job);
+  ArtStats::record(ArtStats::Stage::queueWait, time() - rc.request.queuedAt);
+  inProgress[{rc.request.groupString, rc.request.tier}] = rc;
+  fetchPool.busy++;
+  return rc;
 }
 
-void TextureLoadingThreads::finishJob(const std::string& id,
-                                      std::optional<UploadReadyImage> result) {
+void TextureLoadingThreads::finishJob(const std::string& id, TextureTier tier,
+                                      const JobAbort& jobAbort,
+                                      std::shared_ptr<const UploadReadyImage> result,
+                                      t_uint64 contentKey) {
   std::unique_lock lock{mutex};
-  auto job = inProgress.extract(id);
-  outQueue.push_back(LoadResponse{std::move(job.mapped()), std::move(result)});
+  // The engine only needs to be woken up if it has nothing to upload yet
+  bool wake = outQueue.empty();
+  bool delivered = false;
+  auto respond = [&](const std::string& album, const JobAbort& albumAbort) {
+    auto job = inProgress.find({album, tier});
+    if (job == inProgress.end() || job->second.abort != albumAbort)
+      return;  // cancelled
+    pushLoaded(LoadResponse{std::move(job->second.request), result, contentKey});
+    inProgress.erase(job);
+    delivered = true;
+  };
+  respond(id, jobAbort);
+  if (contentKey != 0) {
+    if (auto waiting = sharedJobs.extract(contentKey)) {
+      for (auto& [album, albumAbort] : waiting.mapped()) {
+        respond(album, albumAbort);
+      }
+    }
+  }
+  lock.unlock();
+  if (delivered && wake)
+    onLoaded();
+}
+
+void TextureLoadingThreads::dropJob(const std::string& id, TextureTier tier,
+                                    const JobAbort& jobAbort, t_uint64 contentKey) {
+  {
+    std::scoped_lock lock{mutex};
+    auto job = inProgress.find({id, tier});
+    if (job != inProgress.end() && job->second.abort == jobAbort)
+      inProgress.erase(job);
+    if (contentKey == 0)
+      return;
+    auto waiting = sharedJobs.extract(contentKey);
+    if (!waiting)
+      return;
+    for (auto& [album, albumAbort] : waiting.mapped()) {
+      auto waiter = inProgress.find({album, tier});
+      if (waiter == inProgress.end() || waiter->second.abort != albumAbort)
+        continue;
+      LoadRequest request = std::move(waiter->second.request);
+      inProgress.erase(waiter);
+      enqueue(std::move(request));
+    }
+  }
+  inCondition.notify_all();
+}
+
+void TextureLoadingThreads::cancel(t_inProgress::iterator job, bool requeue) {
+  job->second.abort->abort();
+  LoadRequest request = std::move(job->second.request);
+  inProgress.erase(job);
+  cancelled++;
+  if (requeue)
+    enqueue(std::move(request));
+}
+
+void TextureLoadingThreads::preempt() {
+  if (inQueue.empty() || fetchPool.busy < fetchPool.running)
+    return;
+  auto best = importance(*mostImportant(inQueue.get<1>()));
+  auto worst = inProgress.end();
+  for (auto job = inProgress.begin(); job != inProgress.end(); ++job) {
+    if (job->second.waiting)
+      continue;
+    if (worst == inProgress.end() ||
+        importance(job->second.request) > importance(worst->second.request))
+      worst = job;
+  }
+  if (worst == inProgress.end() || !(best < importance(worst->second.request)))
+    return;
+  cancel(worst, true);
+  preempted++;
+  inCondition.notify_one();
 }
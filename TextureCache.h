@@ -4,6 +4,7 @@
 #include "BlockingQueue.h"
 #include "DbAlbumCollection.h"
 #include "Image.h"
+#include "TextureAtlas.h"
 #include "utils.h"
 
 namespace bomi = boost::multi_index;
@@ -14,59 +15,250 @@ class EngineThread;
 struct TextureCacheMeta {
   std::string groupString;
   unsigned int collectionVersion{0};
-  // (generation, -distance to center)
-  std::pair<unsigned int, int> priority;
+  // Position of the album in the collection when it was requested
+  int rank{0};
+  TextureTier tier{TextureTier::full};
+  // Fingerprint of the art sources when the art was loaded, see artSourceFingerprint.
+  // Zero if not known.
+  t_uint64 artSource{0};
 };
 
 class TextureLoadingThreads {
  public:
-  TextureLoadingThreads();
+  /// `onLoaded` is called on the loader threads when results become available for
+  /// getLoaded
+  explicit TextureLoadingThreads(std::function<void()> onLoaded);
   NO_MOVE_NO_COPY(TextureLoadingThreads);
   ~TextureLoadingThreads();
 
-  struct LoadRequest {
-    TextureCacheMeta meta;
+  struct LoadRequest : TextureCacheMeta {
     metadb_handle_ptr track;
+    // The art source of the cached texture, zero if there is none. If the art source
+    // did not change, the loader answers `unchanged` instead of loading the art again.
+    t_uint64 cachedSource = 0;
+    // When the request first entered the queue, see ArtStats::Stage::queueWait
+    double queuedAt = 0;
   };
 
-  struct LoadResponse {
-    TextureCacheMeta meta;
-    std::optional<UploadReadyImage> image;
+  struct LoadResponse : TextureCacheMeta {
+    // Shared by all albums with the same art
+    std::shared_ptr<const UploadReadyImage> image;
+    // Identifies the art, see ThumbnailStore::contentKey. Zero if unknown.
+    t_uint64 contentKey;
+    // The cached texture is still current, see LoadRequest::cachedSource
+    bool unchanged = false;
+  };
+
+  /// Requests of tier `minTier` and above with ranks in [first, last]
+  struct DropRange {
+    TextureTier minTier;
+    int first;
+    int last;
   };
 
   void flushQueue();
-  void setQueue(std::vector<LoadRequest>&& data);
+  /// Replaces the whole queue and cancels the running jobs that are not part of it.
+  /// Workers pick the request closest to `center`, on ties the lower tier.
+  void setQueue(int center, std::vector<LoadRequest>&& data);
+  /// Moves the queue center, drops or cancels all requests within the given ranges
+  /// and adds or re-prioritizes the requests in `added`.
+  void updateQueue(int center, const std::vector<DropRange>& dropped,
+                   std::vector<LoadRequest>&& added);
   std::optional<LoadResponse> getLoaded();
+  /// Whether getLoaded would return a result
+  bool hasLoaded();
   void pause();
   void resume();
   void setPriority(bool highPriority);
 
+  struct Stats {
+    size_t queued;
+    // Busy and running threads per stage. The stages start threads as work backs up
+    // and let them exit after idling.
+    int fetching;
+    int fetchThreads;
+    int maxFetchThreads;
+    // Share of the fetch time spent on the CPU, the rest is waiting for I/O
+    float fetchCpuShare;
+    size_t decodeQueue;
+    int decoding;
+    int decodeThreads;
+    size_t resizeQueue;
+    int resizing;
+    int resizeThreads;
+    size_t loaded;
+    // Results waiting for upload, and art or pixels held by the fetch -> decode ->
+    // resize pipeline
+    size_t loadedBytes;
+    size_t pipelineBytes;
+    // Running jobs that were cancelled since startup, and how many of these made room
+    // for more important requests
+    size_t cancelled;
+    size_t preempted;
+  };
+  Stats getStats();
+
  private:
-  std::pair<std::string, metadb_handle_ptr> takeJob();
-  void finishJob(const std::string&, std::optional<UploadReadyImage>);
+  using JobAbort = std::shared_ptr<abort_callback_impl>;
+
+  // A request a worker has taken. Each has its own abort callback, which cancels it at
+  // the next check. This also aborts album art extraction and decoding.
+  struct RunningJob {
+    LoadRequest request;
+    JobAbort abort;
+    // Waits for a job with the same art instead of doing any work
+    bool waiting = false;
+  };
+
+  // Art that moves through the fetch -> decode -> resize pipeline
+  struct PipelineJob {
+    std::string id;
+    TextureTier tier;
+    JobAbort abort;
+    t_uint64 fingerprint;
+    t_uint64 contentKey;
+    album_art_data::ptr art;
+    std::optional<Image> image;
+    // Size of the art or pixels this job holds, see pipelineBytes
+    size_t bytes = 0;
+  };
+
+  // The worker threads of one pipeline stage, between minThreads and maxThreads
+  struct StagePool {
+    const char* name;
+    void (TextureLoadingThreads::*run)();
+    int minThreads;
+    int maxThreads;
+    // Guarded by mutex
+    int running = 0;
+    double lastSpawn = 0;
+    std::atomic<int> busy = 0;
+  };
+
+  /// Waits for a request. Returns nullopt if the calling fetcher idled long enough to
+  /// exit.
+  std::optional<RunningJob> takeJob();
+  void enqueue(LoadRequest&& request);
+  /// Records the art source of a running job. Finishes the job as `unchanged` and
+  /// returns true if it matches the source of the cached texture.
+  bool checkArtSource(const std::string&, TextureTier, const JobAbort&,
+                      t_uint64 artSource);
+  /// Also finishes the jobs that wait for the same content
+  void finishJob(const std::string&, TextureTier, const JobAbort&,
+                 std::shared_ptr<const UploadReadyImage>, t_uint64 contentKey = 0);
+  /// Called by the workers when they notice a job was cancelled. The jobs that wait for
+  /// the same content go back into the queue.
+  void dropJob(const std::string&, TextureTier, const JobAbort&, t_uint64 contentKey = 0);
+  using t_inProgress = std::map<std::pair<std::string, TextureTier>, RunningJob>;
+  /// Cancels a running job, and puts its request back into the queue if `requeue`
+  void cancel(t_inProgress::iterator job, bool requeue);
+  /// Cancels the least important running job if the best queued request is more
+  /// important and all fetchers are busy
+  void preempt();
+  /// Starts a thread for `pool`, mutex must be held
+  void spawnWorker(StagePool& pool);
+  /// Starts a thread for a CPU-bound stage if `queued` jobs wait and all of its
+  /// threads are busy
+  void growStage(StagePool& pool, size_t queued);
+  /// Starts a fetcher if enough requests wait, all fetchers are busy and they mostly
+  /// wait for I/O. Mutex must be held.
+  void growFetchers();
+  /// Lets the calling thread exit if `pool` has more than its minimum. Mutex must be
+  /// held.
+  bool retire(StagePool& pool);
+  /// Tracks how much of a fetch was spent on the CPU. Returns true if the calling
+  /// fetcher should exit, as threads beyond the core count don't help CPU-bound
+  /// fetches.
+  bool recordFetch(double seconds, double cpuSeconds);
+  void waitUntilResumed();
+  void updateBackgroundMode(bool& inBackground);
 
-  std::vector<std::thread> threads;
   abort_callback_impl abort;
+  std::function<void()> onLoaded;
   std::atomic<bool> highPriority = false;
   std::shared_mutex pauseMutex;
   std::unique_lock<std::shared_mutex> pauseLock{pauseMutex, std::defer_lock};
 
   std::mutex mutex;
   std::condition_variable inCondition;
-  std::deque<LoadRequest> inQueue;
-  std::unordered_map<std::string, TextureCacheMeta> inProgress;
-  std::deque<LoadResponse> outQueue;
+  using t_loadQueue = bomi::multi_index_container<
+      LoadRequest,
+      bomi::indexed_by<
+          bomi::hashed_unique<bomi::composite_key<
+              LoadRequest,
+              bomi::member<TextureCacheMeta, std::string, &LoadRequest::groupString>,
+              bomi::member<TextureCacheMeta, TextureTier, &LoadRequest::tier>>>,
+          bomi::ordered_non_unique<bomi::composite_key<
+              LoadRequest,
+              bomi::member<TextureCacheMeta, TextureTier, &LoadRequest::tier>,
+              bomi::member<TextureCacheMeta, int, &LoadRequest::rank>>>>>;
+  t_loadQueue inQueue;
+  int queueCenter = 0;
+  /// Requests that compare lower are started first, results that compare lower are
+  /// uploaded first
+  std::pair<int, TextureTier> importance(const TextureCacheMeta& entry) const;
+  /// The most important entry of a non-empty queue ordered by tier and rank, such as
+  /// the second index of inQueue and outQueue
+  template <class RankIndex>
+  typename RankIndex::iterator mostImportant(RankIndex& rankIndex);
+  t_inProgress inProgress;
+  // Indexed like inQueue, as the engine takes results and enqueue matches requests with
+  // them while the workers wait for the mutex
+  using t_outQueue = bomi::multi_index_container<
+      LoadResponse,
+      bomi::indexed_by<
+          bomi::hashed_unique<bomi::composite_key<
+              LoadResponse,
+              bomi::member<TextureCacheMeta, std::string, &LoadResponse::groupString>,
+              bomi::member<TextureCacheMeta, TextureTier, &LoadResponse::tier>>>,
+          bomi::ordered_non_unique<bomi::composite_key<
+              LoadResponse,
+              bomi::member<TextureCacheMeta, TextureTier, &LoadResponse::tier>,
+              bomi::member<TextureCacheMeta, int, &LoadResponse::rank>>>>>;
+  t_outQueue outQueue;
+  size_t outQueueBytes = 0;
+  // Number of results in outQueue per image. Albums with the same art share their
+  // image, which counts towards outQueueBytes until the last of them is taken.
+  std::unordered_map<const UploadReadyImage*, int> outQueueImages;
+  /// Adds a result to outQueue, replacing an older one for the same album and tier.
+  /// Mutex must be held.
+  void pushLoaded(LoadResponse&& response);
+  /// Removes a result from outQueue. Mutex must be held.
+  LoadResponse takeLoaded(t_outQueue::iterator loaded);
+  // Albums whose art turned out to be identical to that of a job in the pipeline, by
+  // content key. They are finished along with that job.
+  std::map<t_uint64, std::vector<std::pair<std::string, JobAbort>>> sharedJobs;
+  size_t cancelled = 0;
+  size_t preempted = 0;
+
+  // Threads exit on their own, and add themselves to finishedThreads to be joined
+  std::map<std::thread::id, std::thread> threads;
+  std::vector<std::thread::id> finishedThreads;
+  StagePool fetchPool;
+  StagePool decodePool;
+  StagePool resizePool;
+  float fetchCpuShare = 0;
+  std::atomic<size_t> pipelineBytes = 0;
+  BoundedQueue<PipelineJob> decodeQueue;
+  BoundedQueue<PipelineJob> resizeQueue;
 
-  void run();
+  /// Runs the album art extractor, I/O-bound
+  void runFetch();
+  /// Decodes the compressed image data, CPU-bound
+  void runDecode();
+  /// Resizes to texture dimensions, CPU-bound
+  void runResize();
 };
 
 class TextureCache {
   DbAlbumCollection& db;
   EngineThread& thread;
   class ScriptedCoverPositions& coverPos;
+  const class WorldState& worldState;
 
  public:
-  TextureCache(EngineThread&, DbAlbumCollection&, ScriptedCoverPositions&);
+  TextureCache(EngineThread&, DbAlbumCollection&, ScriptedCoverPositions&,
+               const WorldState&);
 
   const GLImage* getAlbumTexture(const std::string& albumName);
   GLImage& getLoadingTexture();
@@ -74,28 +266,90 @@ class TextureCache {
   void trimCache();
   void clearCache();
   void startLoading(const DBPos& target);
+  /// Cached textures stay in use until the loader has checked whether their art
+  /// source changed
   void onCollectionReload();
+  /// Call before and after applying modified tracks to the collection. Marks the
+  /// cached textures of the albums holding them for the same check.
+  void onTracksModified(const metadb_handle_list& tracks);
   void updateLoadingQueue(const DBIter& queueCenter);
+  /// Whether albums were left out of the loading queue because the scroll animation
+  /// passes them too quickly. Call startLoading once it has settled to load them.
+  bool hasDeferredLoads() const;
+  /// Whether the loading queue is centered ahead of the target, as it was moving. Call
+  /// startLoading once the animation has settled to center it on the target.
+  bool isLoadingAhead() const;
   void uploadTextures();
+  /// Whether loaded textures wait for upload, e.g. because they did not fit into the
+  /// upload budget of the last frame
+  bool hasPendingUploads();
 
   void pauseLoading();
   void resumeLoading();
   void setPriority(bool highPriority);
+  TextureLoadingThreads::Stats getLoaderStats();
+
+  struct MemoryUsage {
+    // Video memory of the cached covers, and of the atlas pages they live in
+    size_t textures;
+    size_t atlases;
+    size_t budget;
+    // Main memory held by the loader
+    size_t loaded;
+    size_t pipeline;
+  };
+  MemoryUsage getMemoryUsage();
 
  private:
-  int maxCacheSize();
+  size_t memoryBudget();
+  /// Number of albums around the center that fit into the memory budget
+  size_t budgetCount();
+  /// Number of albums around the center to load
+  int maxLoadCount();
+  // Cache entries from older versions need to be checked before they count as loaded
   unsigned int collectionVersion = 0;
 
+  /// Ranks of the albums between `from` and `to` that the scroll animation shows for
+  /// less than cfgMinDwellTime
+  std::pair<int, int> passedRange(int from, int to);
+
+  // The range of album ranks that was last handed to the loader. Albums in
+  // [fullFirst, fullLast] are loaded in full resolution, the others as proxies.
+  // Albums in [deferFirst, deferLast] are not loaded at all for now.
+  struct LoadWindow {
+    int first;
+    int last;
+    int fullFirst;
+    int fullLast;
+    int center;
+    // Where the loader starts, ahead of `center` while the target moves
+    int stop;
+    int deferFirst;
+    int deferLast;
+    unsigned int dbVersion;
+    unsigned int collectionVersion;
+  };
+  std::optional<LoadWindow> loadWindow;
+
   void reloadSpecialTextures();
   GLImage noCoverTexture;
   GLImage loadingTexture;
 
-  unsigned int cacheGeneration = 0;
+  // One atlas per texture size and compression. Declared before the cache, so that it
+  // outlives the slots handed out to cache entries.
+  std::map<std::pair<int, bool>, TextureAtlas> atlases;
+  GLImage upload(const UploadReadyImage& image);
 
   struct CacheItem : TextureCacheMeta {
-    CacheItem(const TextureCacheMeta& meta, std::optional<GLImage>&& texture)
-        : TextureCacheMeta(meta), texture(std::move(texture)){};
-    std::optional<GLImage> texture;
+    CacheItem(const TextureCacheMeta& meta, std::shared_ptr<const GLImage> texture,
+              t_uint64 contentKey)
+        : TextureCacheMeta(meta), texture(std::move(texture)), contentKey(contentKey){};
+    // Shared by all albums with the same art
+    std::shared_ptr<const GLImage> texture;
+    t_uint64 contentKey;
+    // Needs the same check as entries from older versions, see onCollectionReload and
+    // onTracksModified. Keeps its rank, so it is not evicted before the check.
+    bool unverified = false;
   };
   using t_textureCache = bomi::multi_index_container<
       CacheItem,
@@ -105,10 +359,17 @@ class TextureCache {
           bomi::ordered_non_unique<bomi::composite_key<
               CacheItem,
               bomi::member<TextureCacheMeta, unsigned int, &CacheItem::collectionVersion>,
-              bomi::member<TextureCacheMeta, std::pair<unsigned int, int>,
-                           &CacheItem::priority>>>>>;
+              bomi::member<TextureCacheMeta, int, &CacheItem::rank>>>>>;
 
   t_textureCache textureCache;
+  // Sum of the memory sizes of all textures in the cache, shared ones counted once
+  size_t cacheBytes = 0;
+  // The textures in the cache by content key
+  std::unordered_map<t_uint64, std::weak_ptr<const GLImage>> sharedTextures;
+  std::shared_ptr<const GLImage> sharedTexture(
+      const TextureLoadingThreads::LoadResponse& loaded);
+  /// Call before removing `item` from the cache
+  void releaseTexture(const CacheItem& item);
 
   TextureLoadingThreads bgLoader;
 
@@ -0,0 +1,343 @@
+#include "ThumbnailStore.h"
+
+#include "Image.h"
+#include "config.h"
+#include "utils.h"
+
+namespace {
+constexpr uint32_t packMagic = 0x48544643;  // "CFTH"
+constexpr uint32_t indexMagic = 0x49544643;  // "CFTI"
+constexpr uint32_t storeVersion = 5;
+// Once the pack grows beyond this, it is thrown away and refilled from scratch
+constexpr t_uint64 maxPackSize = t_uint64{1} << 30;
+// Albums without art are probed again after 30 days, in FILETIME units
+constexpr t_uint64 missingArtLifetime = t_uint64{30} * 24 * 3600 * 10'000'000;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+struct IndexHeader {
+  FileHeader file;
+  t_uint64 packEnd;
+  t_uint64 count;
+};
+
+t_uint64 now() {
+  FILETIME time;
+  GetSystemTimeAsFileTime(&time);
+  return t_uint64(time.dwHighDateTime) << 32 | time.dwLowDateTime;
+}
+
+class ThumbnailStoreFlusher : public initquit {
+ public:
+  void on_init() final {}
+  void on_quit() final { ThumbnailStore::instance().flush(); }
+};
+static initquit_factory_t<ThumbnailStoreFlusher> g_thumbnailStoreFlusher;
+}  // namespace
+
+t_uint64 artSourceFingerprint(const metadb_handle_ptr& track) {
+  pfc::string8 path;
+  filesystem::g_get_display_path(track->get_path(), path);
+  t_filestats stats = track->get_filestats();
+  t_uint32 subsong = track->get_subsong_index();
+
+  t_uint64 hash = fnv1a64(path.get_ptr(), path.get_length());
+  hash = fnv1a64(&subsong, sizeof(subsong), hash);
+  hash = fnv1a64(&stats.m_size, sizeof(stats.m_size), hash);
+  hash = fnv1a64(&stats.m_timestamp, sizeof(stats.m_timestamp), hash);
+
+  // The folder timestamp changes when sidecar images are added, removed or renamed
+  WIN32_FILE_ATTRIBUTE_DATA folder{};
+  pfc::string8 directory = pfc::string_directory(path);
+  if (0 != GetFileAttributesExW(pfc::stringcvt::string_wide_from_utf8(directory),
+                                GetFileExInfoStandard, &folder)) {
+    hash = fnv1a64(&folder.ftLastWriteTime, sizeof(folder.ftLastWriteTime), hash);
+  }
+  return hash;
+}
+
+ThumbnailStore& ThumbnailStore::instance() {
+  static ThumbnailStore store;
+  return store;
+}
+
+t_uint64 ThumbnailStore::settingsHash(TextureTier tier, t_uint64 seed) {
+  // Everything that changes the resized pixels
+  int settings[] = {maxTextureSize(tier), cfgResizeFilter, cfgResizeSrgb};
+  return fnv1a64(settings, sizeof(settings), seed);
+}
+
+t_uint64 ThumbnailStore::entryKey(const std::string& albumKey, t_uint64 fingerprint,
+                                  TextureTier tier) {
+  t_uint64 hash = fnv1a64(albumKey.data(), albumKey.size());
+  hash = fnv1a64(&fingerprint, sizeof(fingerprint), hash);
+  return settingsHash(tier, hash);
+}
+
+t_uint64 ThumbnailStore::missingKey(const std::string& albumKey,
+                                    t_uint64 fingerprint) {
+  const char salt[] = "missing";
+  t_uint64 hash = fnv1a64(salt, sizeof(salt));
+  hash = fnv1a64(albumKey.data(), albumKey.size(), hash);
+  return fnv1a64(&fingerprint, sizeof(fingerprint), hash);
+}
+
+t_uint64 ThumbnailStore::contentKey(const void* data, size_t size, TextureTier tier) {
+  return settingsHash(tier, fnv1a64(data, size));
+}
+
+void ThumbnailStore::addToIndex(const IndexEntry& entry) {
+  index[entry.header.key] = entry;
+  if (entry.header.contentKey != 0)
+    contentIndex[entry.header.contentKey] = entry.header.key;
+}
+
+void ThumbnailStore::ensureOpen() {
+  std::call_once(openFlag, [&] {
+    std::unique_lock lock{mutex};
+    packPath = profileFile("foo_chronflow_thumbs.pack");
+    indexPath = profileFile("foo_chronflow_thumbs.index");
+    pack.reset(CreateFileW(packPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+                           FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                           nullptr));
+    if (!pack) {
+      IF_DEBUG(console::out() << "Failed to open thumbnail store");
+      return;
+    }
+    FileHeader header{};
+    if (!readAt(0, &header, sizeof(header)) || header.magic != packMagic ||
+        header.version != storeVersion) {
+      resetPack();
+      return;
+    }
+    if (!loadIndex())
+      rebuildIndex();
+  });
+}
+
+void ThumbnailStore::resetPack() {
+  index.clear();
+  contentIndex.clear();
+  indexDirty = true;
+  packEnd = 0;
+  LARGE_INTEGER start{};
+  if (0 == SetFilePointerEx(pack.get(), start, nullptr, FILE_BEGIN) ||
+      0 == SetEndOfFile(pack.get())) {
+    pack.reset();
+    return;
+  }
+  FileHeader header{packMagic, storeVersion};
+  if (!writeAt(0, &header, sizeof(header))) {
+    pack.reset();
+    return;
+  }
+  packEnd = sizeof(header);
+}
+
+bool ThumbnailStore::loadIndex() {
+  wil::unique_hfile file{CreateFileW(indexPath.c_str(), GENERIC_READ, 0, nullptr,
+                                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)};
+  if (!file)
+    return false;
+  LARGE_INTEGER packSize{};
+  if (0 == GetFileSizeEx(pack.get(), &packSize))
+    return false;
+
+  IndexHeader header{};
+  DWORD read = 0;
+  if (0 == ReadFile(file.get(), &header, sizeof(header), &read, nullptr) ||
+      read != sizeof(header) || header.file.magic != indexMagic ||
+      header.file.version != storeVersion ||
+      header.packEnd != t_uint64(packSize.QuadPart)) {
+    return false;
+  }
+  std::vector<IndexEntry> entries(header.count);
+  DWORD entriesSize = DWORD(entries.size() * sizeof(IndexEntry));
+  if (0 == ReadFile(file.get(), entries.data(), entriesSize, &read, nullptr) ||
+      read != entriesSize) {
+    return false;
+  }
+  index.reserve(entries.size());
+  for (auto& entry : entries) {
+    addToIndex(entry);
+  }
+  packEnd = header.packEnd;
+  // The pack will be appended to from now on, so this index is about to get stale.
+  // If we crash before the next flush, we rebuild it from the pack file.
+  file.reset();
+  DeleteFileW(indexPath.c_str());
+  return true;
+}
+
+void ThumbnailStore::rebuildIndex() {
+  LARGE_INTEGER packSize{};
+  if (0 == GetFileSizeEx(pack.get(), &packSize)) {
+    resetPack();
+    return;
+  }
+  index.clear();
+  contentIndex.clear();
+  indexDirty = true;
+  t_uint64 offset = sizeof(FileHeader);
+  RecordHeader header{};
+  while (offset + sizeof(header) <= t_uint64(packSize.QuadPart)) {
+    if (!readAt(offset, &header, sizeof(header)))
+      break;
+    t_uint64 payloadOffset = offset + sizeof(header);
+    if (header.payloadSize != header.width * header.height * 3 ||
+        payloadOffset + header.payloadSize > t_uint64(packSize.QuadPart))
+      break;  // torn write at the end of the pack
+    addToIndex(IndexEntry{payloadOffset, header});
+    offset = payloadOffset + header.payloadSize;
+  }
+  packEnd = offset;
+  if (packEnd != t_uint64(packSize.QuadPart)) {
+    LARGE_INTEGER end{};
+    end.QuadPart = packEnd;
+    SetFilePointerEx(pack.get(), end, nullptr, FILE_BEGIN);
+    SetEndOfFile(pack.get());
+  }
+}
+
+bool ThumbnailStore::readAt(t_uint64 offset, void* buffer, size_t size) {
+  OVERLAPPED position{};
+  position.Offset = DWORD(offset);
+  position.OffsetHigh = DWORD(offset >> 32);
+  DWORD read = 0;
+  return 0 != ReadFile(pack.get(), buffer, DWORD(size), &read, &position) &&
+         read == size;
+}
+
+bool ThumbnailStore::writeAt(t_uint64 offset, const void* buffer, size_t size) {
+  OVERLAPPED position{};
+  position.Offset = DWORD(offset);
+  position.OffsetHigh = DWORD(offset >> 32);
+  DWORD written = 0;
+  return 0 != WriteFile(pack.get(), buffer, DWORD(size), &written, &position) &&
+         written == size;
+}
+
+std::optional<UploadReadyImage> ThumbnailStore::read(const IndexEntry& entry) {
+  const RecordHeader& header = entry.header;
+  Image::malloc_ptr data{BufferPool::allocate(header.payloadSize)};
+  if (data == nullptr)
+    throw std::bad_alloc{};
+  if (!readAt(entry.offset, data.get(), header.payloadSize))
+    return std::nullopt;
+  return UploadReadyImage(Image{std::move(data), int(header.width), int(header.height)},
+                          header.originalAspect);
+}
+
+std::optional<ThumbnailStore::Thumbnail> ThumbnailStore::get(const std::string& albumKey,
+                                                             t_uint64 fingerprint,
+                                                             TextureTier tier) {
+  ensureOpen();
+  std::shared_lock lock{mutex};
+  if (!pack)
+    return std::nullopt;
+  auto entry = index.find(entryKey(albumKey, fingerprint, tier));
+  if (entry == index.end() || entry->second.header.payloadSize == 0)
+    return std::nullopt;
+  auto image = read(entry->second);
+  if (!image)
+    return std::nullopt;
+  return Thumbnail{std::move(image.value()), entry->second.header.contentKey};
+}
+
+std::optional<UploadReadyImage> ThumbnailStore::getShared(const std::string& albumKey,
+                                                          t_uint64 fingerprint,
+                                                          TextureTier tier,
+                                                          t_uint64 contentKey) {
+  ensureOpen();
+  std::unique_lock lock{mutex};
+  if (!pack)
+    return std::nullopt;
+  auto shared = contentIndex.find(contentKey);
+  if (shared == contentIndex.end())
+    return std::nullopt;
+  // The entry might have been replaced with different art since
+  auto found = index.find(shared->second);
+  if (found == index.end() || found->second.header.contentKey != contentKey)
+    return std::nullopt;
+  IndexEntry entry = found->second;
+  auto image = read(entry);
+  if (!image)
+    return std::nullopt;
+  // Point the album at the same payload. Mappings like this live in the index file
+  // only, they are lost if the index has to be rebuilt from the pack.
+  entry.header.key = entryKey(albumKey, fingerprint, tier);
+  index[entry.header.key] = entry;
+  indexDirty = true;
+  return image;
+}
+
+void ThumbnailStore::put(const std::string& albumKey, t_uint64 fingerprint,
+                         TextureTier tier, t_uint64 contentKey,
+                         const UploadReadyImage& image) {
+  ensureOpen();
+  const Image& pixels = image.getImage();
+  append(RecordHeader{entryKey(albumKey, fingerprint, tier), contentKey, now(),
+                      uint32_t(pixels.width), uint32_t(pixels.height),
+                      float(image.getOriginalAspect()),
+                      uint32_t(pixels.width * pixels.height * 3)},
+         pixels.data.get());
+}
+
+bool ThumbnailStore::isMissing(const std::string& albumKey, t_uint64 fingerprint) {
+  ensureOpen();
+  std::shared_lock lock{mutex};
+  auto entry = index.find(missingKey(albumKey, fingerprint));
+  return entry != index.end() &&
+         now() - entry->second.header.writtenAt < missingArtLifetime;
+}
+
+void ThumbnailStore::putMissing(const std::string& albumKey, t_uint64 fingerprint) {
+  ensureOpen();
+  append(RecordHeader{missingKey(albumKey, fingerprint), 0, now(), 0, 0, 1.0f, 0},
+         nullptr);
+}
+
+void ThumbnailStore::append(RecordHeader header, const void* payload) {
+  std::unique_lock lock{mutex};
+  if (!pack)
+    return;
+  if (packEnd + sizeof(header) + header.payloadSize > maxPackSize)
+    resetPack();
+  t_uint64 offset = packEnd;
+  if (!writeAt(offset, &header, sizeof(header)) ||
+      (header.payloadSize > 0 &&
+       !writeAt(offset + sizeof(header), payload, header.payloadSize)))
+    return;
+  packEnd = offset + sizeof(header) + header.payloadSize;
+  addToIndex(IndexEntry{offset + sizeof(header), header});
+  indexDirty = true;
+}
+
+void ThumbnailStore::flush() {
+  std::unique_lock lock{mutex};
+  if (!pack || !indexDirty)
+    return;
+  std::wstring tmpPath = indexPath + L".tmp";
+  wil::unique_hfile file{CreateFileW(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr,
+                                     CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)};
+  if (!file)
+    return;
+  IndexHeader header{{indexMagic, storeVersion}, packEnd, index.size()};
+  std::vector<IndexEntry> entries;
+  entries.reserve(index.size());
+  for (auto& [key, entry] : index) {
+    entries.push_back(entry);
+  }
+  DWORD written = 0;
+  DWORD entriesSize = DWORD(entries.size() * sizeof(IndexEntry));
+  if (0 == WriteFile(file.get(), &header, sizeof(header), &written, nullptr) ||
+      0 == WriteFile(file.get(), entries.data(), entriesSize, &written, nullptr)) {
+    return;
+  }
+  file.reset();
+  if (0 != MoveFileExW(tmpPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    indexDirty = false;
+}
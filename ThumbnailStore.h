@@ -0,0 +1,96 @@
+#pragma once
+#include "Image.h"
+#include "utils.h"
+
+/// Cheap fingerprint of everything the album art extractor looks at for `track`:
+/// the file itself (size and timestamp) and the folder it lives in (for sidecar images).
+t_uint64 artSourceFingerprint(const metadb_handle_ptr& track);
+
+/// Persistent, process-wide store of upload-ready cover images.
+///
+/// Resized payloads are appended to a pack file in the foobar2000 profile directory.
+/// An index file maps (album key, art source fingerprint, texture size) to their
+/// offsets. The index is written on shutdown and rebuilt from the pack file if it is
+/// missing or out of date.
+///
+/// Payloads are also indexed by content key, so albums with byte-identical art share
+/// one payload.
+///
+/// Albums without art get records without payload, so they are not probed again until
+/// their art source fingerprint changes.
+class ThumbnailStore {
+ public:
+  static ThumbnailStore& instance();
+  NO_MOVE_NO_COPY(ThumbnailStore);
+  ~ThumbnailStore() = default;
+
+  /// Identifies the textures made from the raw art `data` in `tier`
+  static t_uint64 contentKey(const void* data, size_t size, TextureTier tier);
+
+  struct Thumbnail {
+    UploadReadyImage image;
+    t_uint64 contentKey;
+  };
+  std::optional<Thumbnail> get(const std::string& albumKey, t_uint64 fingerprint,
+                               TextureTier tier);
+  /// Looks up the thumbnail of any album with the same art. On a hit, the album is
+  /// mapped to it, so that get() finds it without fetching the art next time.
+  std::optional<UploadReadyImage> getShared(const std::string& albumKey,
+                                            t_uint64 fingerprint, TextureTier tier,
+                                            t_uint64 contentKey);
+  void put(const std::string& albumKey, t_uint64 fingerprint, TextureTier tier,
+           t_uint64 contentKey, const UploadReadyImage& image);
+  /// Whether the album had no art when its sources last had `fingerprint`. Expires
+  /// after a while, in case the album art settings of foobar2000 changed.
+  bool isMissing(const std::string& albumKey, t_uint64 fingerprint);
+  void putMissing(const std::string& albumKey, t_uint64 fingerprint);
+  /// Writes the index to disk
+  void flush();
+
+ private:
+  ThumbnailStore() = default;
+
+#pragma pack(push, 1)
+  struct RecordHeader {
+    t_uint64 key;
+    // Zero for albums without art, whose records have no payload
+    t_uint64 contentKey;
+    // FILETIME of the write
+    t_uint64 writtenAt;
+    uint32_t width;
+    uint32_t height;
+    float originalAspect;
+    uint32_t payloadSize;
+  };
+#pragma pack(pop)
+  struct IndexEntry {
+    t_uint64 offset;
+    RecordHeader header;
+  };
+
+  static t_uint64 settingsHash(TextureTier tier, t_uint64 seed);
+  static t_uint64 entryKey(const std::string& albumKey, t_uint64 fingerprint,
+                           TextureTier tier);
+  /// Missing art doesn't depend on the texture settings
+  static t_uint64 missingKey(const std::string& albumKey, t_uint64 fingerprint);
+  void append(RecordHeader header, const void* payload);
+  void addToIndex(const IndexEntry& entry);
+  std::optional<UploadReadyImage> read(const IndexEntry& entry);
+  void ensureOpen();
+  void resetPack();
+  bool loadIndex();
+  void rebuildIndex();
+  bool readAt(t_uint64 offset, void* buffer, size_t size);
+  bool writeAt(t_uint64 offset, const void* buffer, size_t size);
+
+  std::once_flag openFlag;
+  std::shared_mutex mutex;
+  bool indexDirty = false;
+  std::wstring packPath;
+  std::wstring indexPath;
+  wil::unique_hfile pack;
+  t_uint64 packEnd = 0;
+  std::unordered_map<t_uint64, IndexEntry> index;
+  // Content key -> key of one of the index entries with that content
+  std::unordered_map<t_uint64, t_uint64> contentIndex;
+};
@@ -0,0 +1,130 @@
+// Measures throughput and quality (PSNR) of image_kernels::encodeBC1 on a directory
+// of real cover images. Every cover is resized to the texture size first, just like
+// the texture loader does.
+//
+// Build (from the repository root):
+//   cl /O2 /EHsc /std:c++17 bench\bc1_bench.cpp image_kernels.cpp
+//   g++ -O2 -std=c++17 bench/bc1_bench.cpp image_kernels.cpp -o bc1_bench
+// Usage:
+//   bc1_bench <cover directory> [texture size, default 512]
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../image_kernels.h"
+#include "../lib/stb_image.h"
+
+namespace {
+void decode565(uint16_t c, int (&rgb)[3]) {
+  int r = (c >> 11) & 31;
+  int g = (c >> 5) & 63;
+  int b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+/// Reference decoder, as specified by EXT_texture_compression_s3tc
+std::vector<uint8_t> decodeBC1(const uint8_t* blocks, int width, int height) {
+  std::vector<uint8_t> out(size_t(width) * height * 3);
+  for (int by = 0; by < height; by += 4) {
+    for (int bx = 0; bx < width; bx += 4, blocks += 8) {
+      uint16_t c0 = uint16_t(blocks[0] | blocks[1] << 8);
+      uint16_t c1 = uint16_t(blocks[2] | blocks[3] << 8);
+      uint32_t indices =
+          uint32_t(blocks[4] | blocks[5] << 8 | blocks[6] << 16 | blocks[7] << 24);
+      int palette[4][3];
+      decode565(c0, palette[0]);
+      decode565(c1, palette[1]);
+      for (int c = 0; c < 3; c++) {
+        if (c0 > c1) {
+          palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+          palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+          palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+          palette[3][c] = 0;
+        }
+      }
+      for (int i = 0; i < 16; i++) {
+        int x = bx + i % 4;
+        int y = by + i / 4;
+        if (x >= width || y >= height)
+          continue;
+        int index = (indices >> (2 * i)) & 3;
+        for (int c = 0; c < 3; c++) {
+          out[(size_t(y) * width + x) * 3 + c] = uint8_t(palette[index][c]);
+        }
+      }
+    }
+  }
+  return out;
+}
+
+double psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+  double error = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    double d = double(a[i]) - b[i];
+    error += d * d;
+  }
+  error /= double(a.size());
+  return error == 0 ? 99 : 10 * std::log10(255.0 * 255.0 / error);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <cover directory> [texture size]\n", argv[0]);
+    return 1;
+  }
+  int size = argc > 2 ? std::atoi(argv[2]) : 512;
+
+  std::vector<std::vector<uint8_t>> textures;
+  for (auto& entry : std::filesystem::directory_iterator(argv[1])) {
+    int width, height, channels;
+    stbi_uc* data =
+        stbi_load(entry.path().string().c_str(), &width, &height, &channels, 3);
+    if (data == nullptr)
+      continue;
+    auto& texture = textures.emplace_back(size_t(size) * size * 3);
+    image_kernels::resize(data, width, height, texture.data(), size, size,
+                          image_kernels::ResizeFilter::bilinear, true);
+    stbi_image_free(data);
+  }
+  if (textures.empty()) {
+    std::fprintf(stderr, "no images found in %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<uint8_t> blocks(image_kernels::bc1Size(size, size));
+  double seconds = 0;
+  double totalPsnr = 0;
+  double worstPsnr = 99;
+  const int repetitions = 5;
+  for (auto& texture : textures) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++) {
+      image_kernels::encodeBC1(texture.data(), size, size, blocks.data());
+    }
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                   .count() /
+               repetitions;
+    double quality = psnr(texture, decodeBC1(blocks.data(), size, size));
+    totalPsnr += quality;
+    worstPsnr = std::min(worstPsnr, quality);
+  }
+
+  double megapixels = double(textures.size()) * size * size / 1e6;
+  std::printf("%zu covers at %dx%d\n", textures.size(), size, size);
+  std::printf("encode: %.2f ms per cover, %.1f MP/s\n",
+              seconds * 1000 / textures.size(), megapixels / seconds);
+  std::printf("PSNR:   %.2f dB average, %.2f dB worst\n", totalPsnr / textures.size(),
+              worstPsnr);
+  std::printf("size:   %zu bytes per cover instead of %zu\n", blocks.size(),
+              size_t(size) * size * 3);
+  return 0;
+}
@@ -0,0 +1,259 @@
+// Measures album art loading throughput without foobar2000 or a GL context. Runs the
+// texture loader's work on a directory of JPEG/PNG covers: read the file, decode,
+// resize to the texture size, build the mipmaps and optionally compress to BC1. Sweeps
+// thread counts, max texture sizes and compression, and reports images/s, MB/s of
+// encoded art, and p50/p99 per stage.
+//
+// The stages run the same code as the plugin, from cover_pixels.cpp, with buffers from
+// BufferPool. The album art extractor is replaced by reading the file, plus an optional
+// fixed delay to mimic slow network shares. Decoding always uses stb_image, as the
+// scaled WIC JPEG decoder is Windows only. Upload is not measured, there is no GPU.
+//
+// Build (from the repository root):
+//   cl /O2 /EHsc /std:c++17 bench\loader_bench.cpp cover_pixels.cpp BufferPool.cpp
+//      image_kernels.cpp
+//   g++ -O2 -std=c++17 -pthread bench/loader_bench.cpp cover_pixels.cpp BufferPool.cpp
+//      image_kernels.cpp -o loader_bench
+// Usage:
+//   loader_bench <cover directory> [options]
+//     --threads 1,2,4    worker thread counts, default 1,2,4,... up to the core count
+//     --sizes 128,512    max texture sizes, default 128,512,1024
+//     --compress 0,1     BC1 compression settings, default 0,1
+//     --filter <n>       resize filter, 0 box, 1 bilinear, 2 lanczos3, default 1
+//     --srgb 0|1         gamma correct resizing, default 1
+//     --latency <ms>     extra delay per file read, default 0
+//     --repeat <n>       passes over the corpus per configuration, default 1
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../cover_pixels.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+enum Stage { fetch, decode, resize, mipmaps, compress, stageCount };
+const char* stageNames[stageCount] = {"fetch", "decode", "resize", "mipmaps",
+                                      "compress"};
+
+/// Stands in for album_art_manager_v2: returns the encoded art of an album
+class FileArtSource {
+ public:
+  FileArtSource(std::vector<std::filesystem::path> files, int latencyMs)
+      : files(std::move(files)), latencyMs(latencyMs) {}
+
+  size_t size() const { return files.size(); }
+
+  std::vector<uint8_t> query(size_t index) const {
+    if (latencyMs > 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+    std::ifstream in(files[index], std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  }
+
+ private:
+  std::vector<std::filesystem::path> files;
+  int latencyMs;
+};
+
+struct Settings {
+  int threads;
+  // Clamped like maxTextureSize() in Image.cpp
+  int maxTextureSize;
+  bool compress;
+  image_kernels::ResizeFilter filter;
+  bool srgb;
+};
+
+struct ThreadResult {
+  std::vector<double> stageMs[stageCount];
+  size_t images = 0;
+  size_t artBytes = 0;
+  size_t failed = 0;
+};
+
+/// Does what TextureLoadingThreads does for one album, minus the ThumbnailStore
+void loadOne(const FileArtSource& source, size_t index, const Settings& settings,
+             ThreadResult& result) {
+  auto stageStart = Clock::now();
+  auto endStage = [&](Stage stage) {
+    auto now = Clock::now();
+    result.stageMs[stage].push_back(
+        std::chrono::duration<double, std::milli>(now - stageStart).count());
+    stageStart = now;
+  };
+
+  std::vector<uint8_t> art = source.query(index);
+  endStage(fetch);
+  result.artBytes += art.size();
+
+  std::optional<cover_pixels::Pixels> decoded;
+  try {
+    decoded.emplace(cover_pixels::decode(art.data(), art.size()));
+  } catch (const std::exception&) {
+    result.failed++;
+    return;
+  }
+  endStage(decode);
+
+  // What UploadReadyImage(Image&&, TextureTier) and UploadReadyImage::compress do
+  cover_pixels::Pixels image =
+      cover_pixels::toTexture(std::move(decoded.value()), settings.maxTextureSize,
+                              settings.filter, settings.srgb);
+  decoded.reset();
+  endStage(resize);
+
+  std::vector<cover_pixels::Pixels> levels = cover_pixels::mipmaps(image);
+  endStage(mipmaps);
+
+  if (settings.compress) {
+    cover_pixels::compress(image);
+    for (auto& level : levels) cover_pixels::compress(level);
+    endStage(compress);
+  }
+  result.images++;
+}
+
+double percentile(std::vector<double>& samples, double fraction) {
+  if (samples.empty())
+    return 0;
+  auto nth = samples.begin() + std::min(samples.size() - 1,
+                                        size_t(fraction * double(samples.size())));
+  std::nth_element(samples.begin(), nth, samples.end());
+  return *nth;
+}
+
+void run(const FileArtSource& source, const Settings& settings, int repeat) {
+  std::atomic<size_t> next = 0;
+  size_t jobs = source.size() * size_t(repeat);
+  std::vector<ThreadResult> results(settings.threads);
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (auto& result : results) {
+    threads.emplace_back([&] {
+      for (size_t job; (job = next++) < jobs;) {
+        loadOne(source, job % source.size(), settings, result);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  ThreadResult total;
+  for (auto& result : results) {
+    total.images += result.images;
+    total.artBytes += result.artBytes;
+    total.failed += result.failed;
+    for (int s = 0; s < stageCount; s++) {
+      total.stageMs[s].insert(total.stageMs[s].end(), result.stageMs[s].begin(),
+                              result.stageMs[s].end());
+    }
+  }
+  std::printf("%7d %6d %4s %9.1f %8.1f", settings.threads,
+              cover_pixels::powerOfTwo(settings.maxTextureSize),
+              settings.compress ? "bc1" : "-",
+              double(total.images) / seconds, double(total.artBytes) / seconds / 1e6);
+  for (int s = 0; s < stageCount; s++) {
+    if (total.stageMs[s].empty()) {
+      std::printf(" %15s", "-");
+      continue;
+    }
+    std::printf(" %7.2f/%7.2f", percentile(total.stageMs[s], 0.5),
+                percentile(total.stageMs[s], 0.99));
+  }
+  if (total.failed > 0)
+    std::printf("  (%zu failed)", total.failed);
+  std::printf("\n");
+}
+
+std::vector<int> parseList(const char* text) {
+  std::vector<int> values;
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) values.push_back(std::atoi(item.c_str()));
+  return values;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "usage: %s <cover directory> [--threads 1,2,4] [--sizes 128,512] "
+                 "[--compress 0,1] [--filter n] [--srgb 0|1] [--latency ms] "
+                 "[--repeat n]\n",
+                 argv[0]);
+    return 1;
+  }
+  std::vector<int> threadCounts;
+  for (int n = 1; n <= int(std::max(1u, std::thread::hardware_concurrency())); n *= 2)
+    threadCounts.push_back(n);
+  std::vector<int> sizes{128, 512, 1024};
+  std::vector<int> compression{0, 1};
+  // The defaults of cfgResizeFilter and cfgResizeSrgb
+  auto filter = image_kernels::ResizeFilter::bilinear;
+  bool srgb = true;
+  int latencyMs = 0;
+  int repeat = 1;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    std::string option = argv[i];
+    if (option == "--threads") {
+      threadCounts = parseList(argv[i + 1]);
+    } else if (option == "--sizes") {
+      sizes = parseList(argv[i + 1]);
+    } else if (option == "--compress") {
+      compression = parseList(argv[i + 1]);
+    } else if (option == "--filter") {
+      filter = image_kernels::ResizeFilter(std::clamp(std::atoi(argv[i + 1]), 0, 2));
+    } else if (option == "--srgb") {
+      srgb = std::atoi(argv[i + 1]) != 0;
+    } else if (option == "--latency") {
+      latencyMs = std::atoi(argv[i + 1]);
+    } else if (option == "--repeat") {
+      repeat = std::max(1, std::atoi(argv[i + 1]));
+    } else {
+      std::fprintf(stderr, "unknown option %s\n", option.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<std::filesystem::path> files;
+  for (auto& entry : std::filesystem::directory_iterator(argv[1])) {
+    if (entry.is_regular_file())
+      files.push_back(entry.path());
+  }
+  if (files.empty()) {
+    std::fprintf(stderr, "no files found in %s\n", argv[1]);
+    return 1;
+  }
+  std::sort(files.begin(), files.end());
+  FileArtSource source(std::move(files), latencyMs);
+
+  std::printf("%zu files, %d pass(es), %d ms latency per read\n\n", source.size(),
+              repeat, latencyMs);
+  std::printf("%7s %6s %4s %9s %8s", "threads", "size", "fmt", "images/s", "MB/s");
+  for (const char* name : stageNames) std::printf(" %15s", name);
+  std::printf("\n%38s", "");
+  for (int s = 0; s < stageCount; s++) std::printf(" %15s", "p50/p99 ms");
+  std::printf("\n");
+  for (int size : sizes) {
+    for (int compress : compression) {
+      for (int threads : threadCounts) {
+        int maxSize = std::clamp(size, 1, cover_pixels::textureSizeLimit);
+        run(source,
+            Settings{std::max(1, threads), maxSize, compress != 0, filter, srgb},
+            repeat);
+      }
+    }
+  }
+  return 0;
+}
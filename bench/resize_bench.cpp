@@ -0,0 +1,135 @@
+// Compares image_kernels::resize with the stb_image_resize sRGB path the texture
+// loader used before, on a directory of real cover images.
+//
+// Build (from the repository root):
+//   cl /O2 /EHsc /std:c++17 bench\resize_bench.cpp image_kernels.cpp
+//   g++ -O2 -std=c++17 bench/resize_bench.cpp image_kernels.cpp -o resize_bench
+// Usage:
+//   resize_bench <cover directory> [target size, default 512]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "../image_kernels.h"
+#include "../lib/stb_image.h"
+#include "../lib/stb_image_resize.h"
+
+namespace {
+struct Cover {
+  std::string name;
+  int width;
+  int height;
+  std::vector<uint8_t> pixels;
+};
+
+std::vector<Cover> loadCorpus(const std::filesystem::path& directory) {
+  std::vector<Cover> corpus;
+  for (auto& entry : std::filesystem::directory_iterator(directory)) {
+    if (!entry.is_regular_file())
+      continue;
+    int width, height, channels;
+    stbi_uc* data =
+        stbi_load(entry.path().string().c_str(), &width, &height, &channels, 3);
+    if (data == nullptr)
+      continue;
+    corpus.push_back({entry.path().filename().string(), width, height,
+                      std::vector<uint8_t>(data, data + size_t(width) * height * 3)});
+    stbi_image_free(data);
+  }
+  return corpus;
+}
+
+double psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+  double error = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    double d = double(a[i]) - b[i];
+    error += d * d;
+  }
+  error /= double(a.size());
+  return error == 0 ? 99 : 10 * std::log10(255.0 * 255.0 / error);
+}
+
+template <typename Fn>
+double timeMs(Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                   start)
+      .count();
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <cover directory> [target size]\n", argv[0]);
+    return 1;
+  }
+  int targetSize = argc > 2 ? std::atoi(argv[2]) : 512;
+  auto corpus = loadCorpus(argv[1]);
+  if (corpus.empty()) {
+    std::fprintf(stderr, "no images found in %s\n", argv[1]);
+    return 1;
+  }
+
+  struct Variant {
+    const char* name;
+    image_kernels::ResizeFilter filter;
+    bool srgb;
+    double ms = 0;
+    double psnr = 0;
+  };
+  std::vector<Variant> variants{
+      {"box, fast gamma", image_kernels::ResizeFilter::box, false},
+      {"box, sRGB", image_kernels::ResizeFilter::box, true},
+      {"bilinear, fast gamma", image_kernels::ResizeFilter::bilinear, false},
+      {"bilinear, sRGB", image_kernels::ResizeFilter::bilinear, true},
+      {"lanczos3, fast gamma", image_kernels::ResizeFilter::lanczos3, false},
+      {"lanczos3, sRGB", image_kernels::ResizeFilter::lanczos3, true},
+  };
+  double stbirMs = 0;
+  size_t pixels = 0;
+
+  for (auto& cover : corpus) {
+    // Same fit-into-square logic as the texture loader, minus the power of two step
+    double aspect = double(cover.width) / cover.height;
+    int width = aspect >= 1 ? targetSize : std::max(1, int(targetSize * aspect));
+    int height = aspect >= 1 ? std::max(1, int(targetSize / aspect)) : targetSize;
+    pixels += size_t(cover.width) * cover.height;
+
+    std::vector<uint8_t> reference(size_t(width) * height * 3);
+    stbirMs += timeMs([&] {
+      stbir_resize_uint8_srgb(cover.pixels.data(), cover.width, cover.height, 0,
+                              reference.data(), width, height, 0, 3,
+                              STBIR_ALPHA_CHANNEL_NONE, 0);
+    });
+    std::vector<uint8_t> out(reference.size());
+    for (auto& variant : variants) {
+      variant.ms += timeMs([&] {
+        image_kernels::resize(cover.pixels.data(), cover.width, cover.height, out.data(),
+                              width, height, variant.filter, variant.srgb);
+      });
+      variant.psnr += psnr(reference, out);
+    }
+  }
+
+  double megapixels = pixels / 1e6;
+  std::printf("%zu covers, %.1f MP, target %d px\n\n", corpus.size(), megapixels,
+              targetSize);
+  std::printf("%-22s %10s %10s %9s %12s\n", "", "total ms", "MP/s", "speedup",
+              "PSNR vs stb");
+  std::printf("%-22s %10.1f %10.1f %9s %12s\n", "stbir sRGB", stbirMs,
+              megapixels / stbirMs * 1000, "1.00x", "-");
+  for (auto& variant : variants) {
+    std::printf("%-22s %10.1f %10.1f %8.2fx %9.1f dB\n", variant.name, variant.ms,
+                megapixels / variant.ms * 1000, stbirMs / variant.ms,
+                variant.psnr / corpus.size());
+  }
+  return 0;
+}
@@ -160,10 +160,10 @@ static const GUID guid_cfgMultisamplingPasses = {
     0xb5280c57, 0xcc06, 0x4ee9, {0xa8, 0xa3, 0x4f, 0x5, 0xe6, 0x92, 0x5a, 0x62}};
 cfg_int cfgMultisamplingPasses(guid_cfgMultisamplingPasses, 4);
 
-// {036F84C3-B3F7-4aee-873C-DC0EFC46B0D3}
-static const GUID guid_cfgTextureCacheSize = {
-    0x36f84c3, 0xb3f7, 0x4aee, {0x87, 0x3c, 0xdc, 0xe, 0xfc, 0x46, 0xb0, 0xd3}};
-cfg_int cfgTextureCacheSize(guid_cfgTextureCacheSize, 150);
+// {9B7E42C1-5D06-4F3A-8C2B-E17A60D4F985}
+static const GUID guid_cfgTextureMemory = {
+    0x9b7e42c1, 0x5d06, 0x4f3a, {0x8c, 0x2b, 0xe1, 0x7a, 0x60, 0xd4, 0xf9, 0x85}};
+cfg_int cfgTextureMemory(guid_cfgTextureMemory, 256);
 
 // {87491567-6F1C-4339-BF05-FAFE9AF73820}
 static const GUID guid_cfgMaxTextureSize = {
@@ -175,6 +175,36 @@ static const GUID guid_cfgTextureCompression = {
     0xb3177e9b, 0x7188, 0x4cd1, {0x91, 0xad, 0x8, 0x96, 0xe5, 0xd2, 0x32, 0x92}};
 cfg_bool cfgTextureCompression(guid_cfgTextureCompression, false);
 
+// {5C1E2A4B-9D37-4F60-8B1A-6E2D3C4F7A91}
+static const GUID guid_cfgProgressiveLoading = {
+    0x5c1e2a4b, 0x9d37, 0x4f60, {0x8b, 0x1a, 0x6e, 0x2d, 0x3c, 0x4f, 0x7a, 0x91}};
+cfg_bool cfgProgressiveLoading(guid_cfgProgressiveLoading, true);
+
+// {A83F0D62-47C5-4E1B-9F2A-3B7C81D5E046}
+static const GUID guid_cfgFullResDistance = {
+    0xa83f0d62, 0x47c5, 0x4e1b, {0x9f, 0x2a, 0x3b, 0x7c, 0x81, 0xd5, 0xe0, 0x46}};
+cfg_int cfgFullResDistance(guid_cfgFullResDistance, 10);
+
+// {E4B1C9D2-3A5F-4C17-8E62-0D9F7B1A2C53}
+static const GUID guid_cfgResizeFilter = {
+    0xe4b1c9d2, 0x3a5f, 0x4c17, {0x8e, 0x62, 0xd, 0x9f, 0x7b, 0x1a, 0x2c, 0x53}};
+cfg_int cfgResizeFilter(guid_cfgResizeFilter, 1);
+
+// {19F6A3E7-B2C4-4D8A-A051-7C3E9D2F4B68}
+static const GUID guid_cfgResizeSrgb = {
+    0x19f6a3e7, 0xb2c4, 0x4d8a, {0xa0, 0x51, 0x7c, 0x3e, 0x9d, 0x2f, 0x4b, 0x68}};
+cfg_bool cfgResizeSrgb(guid_cfgResizeSrgb, true);
+
+// {6D2E8B14-C0F3-4A97-B5E8-21A4F7C9D306}
+static const GUID guid_cfgUploadBudget = {
+    0x6d2e8b14, 0xc0f3, 0x4a97, {0xb5, 0xe8, 0x21, 0xa4, 0xf7, 0xc9, 0xd3, 0x6}};
+cfg_int cfgUploadBudget(guid_cfgUploadBudget, 4);
+
+// {C27A5E90-8F41-4B3D-96D2-5A0E1B7C3F48}
+static const GUID guid_cfgMinDwellTime = {
+    0xc27a5e90, 0x8f41, 0x4b3d, {0x96, 0xd2, 0x5a, 0xe, 0x1b, 0x7c, 0x3f, 0x48}};
+cfg_int cfgMinDwellTime(guid_cfgMinDwellTime, 150);
+
 // {427CE6B2-DF59-4253-BBC0-157C7A91F226}
 static const GUID guid_cfgEmptyCacheOnMinimize = {
     0x427ce6b2, 0xdf59, 0x4253, {0xbb, 0xc0, 0x15, 0x7c, 0x7a, 0x91, 0xf2, 0x26}};
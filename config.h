@@ -42,9 +42,15 @@ extern cfg_string cfgCoverConfigSel;
 extern cfg_bool cfgMultisampling;
 extern cfg_int cfgMultisamplingPasses;
 
-extern cfg_int cfgTextureCacheSize;
+extern cfg_int cfgTextureMemory;  // megabytes
 extern cfg_int cfgMaxTextureSize;
 extern cfg_bool cfgTextureCompression;
+extern cfg_bool cfgProgressiveLoading;
+extern cfg_int cfgFullResDistance;
+extern cfg_int cfgResizeFilter;  // image_kernels::ResizeFilter
+extern cfg_bool cfgResizeSrgb;
+extern cfg_int cfgUploadBudget;  // milliseconds per frame
+extern cfg_int cfgMinDwellTime;  // milliseconds, 0 loads everything
 extern cfg_bool cfgEmptyCacheOnMinimize;
 
 extern cfg_int cfgVSyncMode;
@@ -0,0 +1,96 @@
+#include "cover_pixels.h"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_MALLOC(size) BufferPool::allocate(size)
+#define STBI_REALLOC(buffer, size) BufferPool::reallocate(buffer, size)
+#define STBI_FREE(buffer) BufferPool::release(buffer)
+#include "lib/stb_image.h"
+
+namespace cover_pixels {
+namespace {
+/// BC1 encodes 4x4 blocks, so every texture has to hold at least one
+constexpr int minTextureSize = 4;
+
+PooledBuffer allocate(size_t size) {
+  PooledBuffer buffer{BufferPool::allocate(size)};
+  if (buffer == nullptr)
+    throw std::bad_alloc{};
+  return buffer;
+}
+}  // namespace
+
+Pixels decode(const void* buffer, size_t len) {
+  int width;
+  int height;
+  int channels_in_file;
+  PooledBuffer data{static_cast<void*>(
+      stbi_load_from_memory(static_cast<const stbi_uc*>(buffer), int(len), &width,
+                            &height, &channels_in_file, 3))};
+  if (data == nullptr) {
+    throw std::runtime_error{"Failed to load image buffer"};
+  }
+  return Pixels{width, height, std::move(data)};
+}
+
+int powerOfTwo(int size) {
+  int p2 = 1;
+  while (p2 < size) p2 = p2 << 1;
+  return p2;
+}
+
+int textureSize(int width, int height, int maxSize) {
+  return std::min(powerOfTwo(maxSize),
+                  powerOfTwo(std::max({width, height, minTextureSize})));
+}
+
+Pixels resize(const Pixels& src, int width, int height,
+              image_kernels::ResizeFilter filter, bool srgb) {
+  PooledBuffer buffer = allocate(size_t(width) * height * 3);
+  image_kernels::resize(static_cast<const uint8_t*>(src.data.get()), src.width,
+                        src.height, static_cast<uint8_t*>(buffer.get()), width, height,
+                        filter, srgb);
+  return Pixels{width, height, std::move(buffer)};
+}
+
+Pixels toTexture(Pixels&& cover, int maxSize, image_kernels::ResizeFilter filter,
+                 bool srgb) {
+  int size = textureSize(cover.width, cover.height, maxSize);
+  if (size == cover.width && size == cover.height)
+    return std::move(cover);
+  return resize(cover, size, size, filter, srgb);
+}
+
+std::vector<Pixels> mipmaps(const Pixels& level) {
+  std::vector<Pixels> levels;
+  const Pixels* previous = &level;
+  while (previous->width > 1 || previous->height > 1) {
+    int width = image_kernels::mipSize(previous->width);
+    int height = image_kernels::mipSize(previous->height);
+    PooledBuffer buffer = allocate(size_t(width) * height * 3);
+    image_kernels::downsampleBox(static_cast<const uint8_t*>(previous->data.get()),
+                                 previous->width, previous->height,
+                                 static_cast<uint8_t*>(buffer.get()));
+    levels.push_back(Pixels{width, height, std::move(buffer)});
+    previous = &levels.back();
+  }
+  return levels;
+}
+
+void compress(Pixels& level) {
+  PooledBuffer blocks = allocate(image_kernels::bc1Size(level.width, level.height));
+  image_kernels::encodeBC1(static_cast<const uint8_t*>(level.data.get()), level.width,
+                           level.height, static_cast<uint8_t*>(blocks.get()));
+  level.data = std::move(blocks);
+}
+
+size_t memorySize(const Pixels& level, bool compressed) {
+  if (compressed)
+    return image_kernels::bc1Size(level.width, level.height);
+  return size_t(level.width) * level.height * 3;
+}
+
+}  // namespace cover_pixels
@@ -0,0 +1,50 @@
+#pragma once
+// Turns encoded cover art into texture levels: decoding with stb_image, sizing,
+// resizing, mipmaps and BC1 compression. All pixel buffers come from BufferPool.
+// Image.cpp wraps these for the texture loader, bench/loader_bench.cpp drives them
+// directly.
+// This file does not depend on foobar2000 or Windows, so it can be built standalone.
+#include <vector>
+
+#include "BufferPool.h"
+#include "image_kernels.h"
+
+namespace cover_pixels {
+
+/// Upper limit of the maximum texture size setting
+constexpr int textureSizeLimit = 1024;
+/// Upper limit of the proxy texture size in progressive loading
+constexpr int proxySizeLimit = 128;
+
+/// Tightly packed RGB8 pixels, or BC1 blocks once compressed
+struct Pixels {
+  int width;
+  int height;
+  PooledBuffer data;
+};
+
+/// Decodes a JPEG, PNG, etc. to RGB8. Throws std::runtime_error if it can't.
+Pixels decode(const void* buffer, size_t len);
+
+/// Smallest power of two that is at least `size`
+int powerOfTwo(int size);
+/// Side length of the texture for a `width` x `height` cover and a size limit of
+/// `maxSize`. Textures are square powers of two, so that all covers of one size fit
+/// into the same atlas slots. Covers smaller than the limit are not scaled up, they get
+/// the smallest power of two that holds them, but at least one BC1 block.
+int textureSize(int width, int height, int maxSize);
+
+/// Throws std::bad_alloc
+Pixels resize(const Pixels& src, int width, int height,
+              image_kernels::ResizeFilter filter, bool srgb);
+/// Resizes `cover` to its square texture size, see textureSize
+Pixels toTexture(Pixels&& cover, int maxSize, image_kernels::ResizeFilter filter,
+                 bool srgb);
+/// Mip levels 1..n of an RGB8 `level`, down to 1x1
+std::vector<Pixels> mipmaps(const Pixels& level);
+/// Replaces the RGB8 pixels of `level` with BC1 blocks
+void compress(Pixels& level);
+/// Bytes held by `level`
+size_t memorySize(const Pixels& level, bool compressed);
+
+}  // namespace cover_pixels
@@ -100,16 +100,30 @@ std::optional<AlbumInfo> EM::GetTargetAlbum::run(Engine& e) {
 
 void EM::ReloadCollection::run(Engine& e) {
   // This will abort any already running reload worker
-  e.reloadWorker = make_unique<DbReloadWorker>(e.thread);
+  metadb_handle_list reconcile;
+  if (e.reloadWorker)
+    reconcile = e.reloadWorker->reconcile;
+  e.reloadWorker =
+      make_unique<DbReloadWorker>(e.thread, e.db.settings(), false, std::move(reconcile));
   // Start spinner animation
   e.windowDirty = true;
 }
 
+std::vector<db_structure::AlbumData> EM::CopyAlbums::run(Engine& e) {
+  return e.db.copyAlbums();
+}
+
 void EM::CollectionReloadedMessage::run(Engine& e) {
   if (!e.reloadWorker || !e.reloadWorker->completed)
     return;
   e.db.onCollectionReload(std::move(e.reloadWorker->db));
+  metadb_handle_list stale = std::move(e.reloadWorker->stale);
   e.reloadWorker.reset();
+  // The snapshot is shown as it is, the tracks that changed since are regrouped in
+  // the background
+  if (stale.get_count() > 0)
+    e.reloadWorker =
+        make_unique<DbReloadWorker>(e.thread, e.db.settings(), false, std::move(stale));
   e.texCache.onCollectionReload();
   e.cacheDirty = true;
   e.thread.invalidateWindow();
@@ -132,7 +146,10 @@ void EM::LibraryItemsRemoved::run(Engine& e, metadb_handle_list tracks,
 }
 void EM::LibraryItemsModified::run(Engine& e, metadb_handle_list tracks,
                                    t_uint64 version) {
-  e.db.handleLibraryChange(version, DbAlbumCollection::items_modified, std::move(tracks));
+  // Tracks can move between albums, check the art of their old and new albums
+  e.texCache.onTracksModified(tracks);
+  e.db.handleLibraryChange(version, DbAlbumCollection::items_modified, tracks);
+  e.texCache.onTracksModified(tracks);
   e.cacheDirty = true;
   e.thread.invalidateWindow();
 }
@@ -70,6 +70,7 @@ struct Engine::Messages {
   E_MSG(ChangeCoverPositionsMessage, std::shared_ptr<CompiledCPInfo>);
   E_ANSWER_MSG(GetAlbumAtCoords, std::optional<AlbumInfo>, int, int);
   E_ANSWER_MSG(GetTargetAlbum, std::optional<AlbumInfo>);
+  E_ANSWER_MSG(CopyAlbums, std::vector<db_structure::AlbumData>);
   E_MSG(Run, std::function<void()>);
   E_MSG(PlaybackNewTrack, metadb_handle_ptr);
   E_MSG(LibraryItemsAdded, metadb_handle_list, t_uint64);
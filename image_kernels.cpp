@@ -0,0 +1,367 @@
+#include "image_kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_KERNELS_SSE2 1
+#include <emmintrin.h>
+#else
+#define IMAGE_KERNELS_SSE2 0
+#endif
+
+namespace image_kernels {
+namespace {
+// Resize scratch buffers up to this many floats are kept for the next call
+constexpr size_t maxRetainedScratch = size_t{4} << 20;
+}  // namespace
+
+void downsampleBox(const uint8_t* src, int width, int height, uint8_t* dst) {
+  const int dstWidth = mipSize(width);
+  const int dstHeight = mipSize(height);
+  // For dimensions of 1 we "sample" the same row/column twice
+  const size_t rowStride = size_t(width) * 3;
+  const size_t nextRow = height > 1 ? rowStride : 0;
+  const size_t nextPixel = width > 1 ? 3 : 0;
+  const size_t pixelStep = width > 1 ? 6 : 3;
+
+  for (int y = 0; y < dstHeight; y++) {
+    const uint8_t* row0 = src + size_t(y) * (height > 1 ? 2 : 1) * rowStride;
+    const uint8_t* row1 = row0 + nextRow;
+    for (int x = 0; x < dstWidth; x++) {
+      const uint8_t* a = row0 + x * pixelStep;
+      const uint8_t* b = row1 + x * pixelStep;
+      for (int c = 0; c < 3; c++) {
+        *dst++ = uint8_t(
+            (unsigned(a[c]) + a[c + nextPixel] + b[c] + b[c + nextPixel] + 2) >> 2);
+      }
+    }
+  }
+}
+
+namespace {
+constexpr int linearTableSize = 1 << 14;
+
+const float* srgbToLinearTable() {
+  static const auto table = [] {
+    std::array<float, 256> t{};
+    for (int i = 0; i < 256; i++) {
+      double v = i / 255.0;
+      t[i] = float(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+const uint8_t* linearToSrgbTable() {
+  static const auto table = [] {
+    std::array<uint8_t, linearTableSize> t{};
+    for (int i = 0; i < linearTableSize; i++) {
+      double v = double(i) / (linearTableSize - 1);
+      v = v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1 / 2.4) - 0.055;
+      t[i] = uint8_t(std::lround(v * 255));
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+double filterRadius(ResizeFilter filter) {
+  switch (filter) {
+    case ResizeFilter::box:
+      return 0.5;
+    case ResizeFilter::bilinear:
+      return 1;
+    case ResizeFilter::lanczos3:
+    default:
+      return 3;
+  }
+}
+
+double sinc(double x) {
+  if (x == 0)
+    return 1;
+  x *= 3.14159265358979323846;
+  return std::sin(x) / x;
+}
+
+double filterWeight(ResizeFilter filter, double x) {
+  switch (filter) {
+    case ResizeFilter::box:
+      return (x >= -0.5 && x < 0.5) ? 1 : 0;
+    case ResizeFilter::bilinear:
+      return std::max(0.0, 1 - std::abs(x));
+    case ResizeFilter::lanczos3:
+    default:
+      return std::abs(x) < 3 ? sinc(x) * sinc(x / 3) : 0;
+  }
+}
+
+/// For every destination pixel along one axis, the span of source pixels that
+/// contribute to it and their normalized weights
+struct Contributions {
+  std::vector<int> first;
+  std::vector<int> count;
+  // `stride` weights per destination pixel
+  std::vector<float> weights;
+  int stride = 0;
+
+  Contributions(int srcSize, int dstSize, ResizeFilter filter) {
+    double scale = double(dstSize) / srcSize;
+    // When downsampling, the filter is stretched to cover all source pixels
+    double filterScale = std::max(1.0, 1 / scale);
+    double support = filterRadius(filter) * filterScale;
+    stride = int(std::ceil(support)) * 2 + 1;
+    first.resize(dstSize);
+    count.resize(dstSize);
+    weights.resize(size_t(dstSize) * stride);
+
+    for (int i = 0; i < dstSize; i++) {
+      double center = (i + 0.5) / scale;
+      int begin = std::max(0, int(center - support + 0.5));
+      int end = std::min(srcSize, int(center + support + 0.5));
+      float* w = &weights[size_t(i) * stride];
+      double total = 0;
+      for (int x = begin; x < end; x++) {
+        double weight = filterWeight(filter, (x - center + 0.5) / filterScale);
+        w[x - begin] = float(weight);
+        total += weight;
+      }
+      if (total == 0) {
+        // Can only happen for the box filter, fall back to nearest neighbor
+        begin = std::min(srcSize - 1, int(center));
+        end = begin + 1;
+        w[0] = 1;
+        total = 1;
+      }
+      for (int x = 0; x < end - begin; x++) {
+        w[x] = float(w[x] / total);
+      }
+      first[i] = begin;
+      count[i] = end - begin;
+    }
+  }
+};
+
+/// Filters one row of floats (3 per pixel) horizontally. `src` must have one float of
+/// padding after the last pixel, and `dst` may be written one float past its last pixel.
+void resampleRow(const float* src, float* dst, const Contributions& c, int dstWidth) {
+  for (int x = 0; x < dstWidth; x++) {
+    const float* w = &c.weights[size_t(x) * c.stride];
+    const float* s = src + size_t(c.first[x]) * 3;
+#if IMAGE_KERNELS_SSE2
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < c.count[x]; k++) {
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(s + 3 * k)));
+    }
+    _mm_storeu_ps(dst + size_t(x) * 3, acc);
+#else
+    float r = 0;
+    float g = 0;
+    float b = 0;
+    for (int k = 0; k < c.count[x]; k++) {
+      r += w[k] * s[3 * k];
+      g += w[k] * s[3 * k + 1];
+      b += w[k] * s[3 * k + 2];
+    }
+    dst[size_t(x) * 3] = r;
+    dst[size_t(x) * 3 + 1] = g;
+    dst[size_t(x) * 3 + 2] = b;
+#endif
+  }
+}
+
+/// Converts a filtered value back to 8 bits
+inline uint8_t encode(float v, bool srgb, const uint8_t* linearToSrgb) {
+  if (srgb) {
+    v = std::clamp(v, 0.0f, 1.0f);
+    return linearToSrgb[int(v * (linearTableSize - 1) + 0.5f)];
+  }
+  return uint8_t(std::clamp(v + 0.5f, 0.0f, 255.0f));
+}
+
+/// Filters `rowCount` rows of `values` floats each vertically, starting at `rows`,
+/// and writes the result as 8 bit values to `dst`.
+void resampleColumn(const float* rows, size_t rowStride, const float* w, int rowCount,
+                    size_t values, uint8_t* dst, bool srgb) {
+  const uint8_t* linearToSrgb = linearToSrgbTable();
+  size_t i = 0;
+#if IMAGE_KERNELS_SSE2
+  const __m128 tableScale = _mm_set1_ps(float(linearTableSize - 1));
+  for (; i + 4 <= values; i += 4) {
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < rowCount; k++) {
+      __m128 row = _mm_loadu_ps(rows + k * rowStride + i);
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), row));
+    }
+    if (srgb) {
+      acc = _mm_min_ps(_mm_max_ps(acc, _mm_setzero_ps()), _mm_set1_ps(1));
+      alignas(16) int32_t index[4];
+      _mm_store_si128(reinterpret_cast<__m128i*>(index),
+                      _mm_cvtps_epi32(_mm_mul_ps(acc, tableScale)));
+      for (int j = 0; j < 4; j++) {
+        dst[i + j] = linearToSrgb[index[j]];
+      }
+    } else {
+      // Rounds to nearest, then saturates to 0..255
+      __m128i v = _mm_cvtps_epi32(acc);
+      v = _mm_packs_epi32(v, v);
+      v = _mm_packus_epi16(v, v);
+      int32_t packed = _mm_cvtsi128_si32(v);
+      std::memcpy(dst + i, &packed, 4);
+    }
+  }
+#endif
+  for (; i < values; i++) {
+    float acc = 0;
+    for (int k = 0; k < rowCount; k++) {
+      acc += w[k] * rows[k * rowStride + i];
+    }
+    dst[i] = encode(acc, srgb, linearToSrgb);
+  }
+}
+}  // namespace
+
+void resize(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst, int dstWidth,
+            int dstHeight, ResizeFilter filter, bool srgb) {
+  const Contributions horizontal(srcWidth, dstWidth, filter);
+  const Contributions vertical(srcHeight, dstHeight, filter);
+  const float* srgbToLinear = srgbToLinearTable();
+
+  // Horizontal pass first, so the vertical pass works on the narrower image when
+  // downsampling. Both buffers carry one float of padding for the SIMD loads/stores.
+  // The buffers are kept per thread, so the loader threads don't allocate several
+  // megabytes for every cover. Unusually large ones are freed again below.
+  const size_t srcValues = size_t(srcWidth) * 3;
+  const size_t rowStride = size_t(dstWidth) * 3;
+  thread_local std::vector<float> line;
+  thread_local std::vector<float> tmp;
+  line.resize(srcValues + 1);
+  tmp.resize(rowStride * srcHeight + 1);
+  for (int y = 0; y < srcHeight; y++) {
+    const uint8_t* in = src + y * srcValues;
+    if (srgb) {
+      for (size_t i = 0; i < srcValues; i++) line[i] = srgbToLinear[in[i]];
+    } else {
+      for (size_t i = 0; i < srcValues; i++) line[i] = in[i];
+    }
+    resampleRow(line.data(), &tmp[y * rowStride], horizontal, dstWidth);
+  }
+
+  for (int y = 0; y < dstHeight; y++) {
+    resampleColumn(&tmp[vertical.first[y] * rowStride], rowStride,
+                   &vertical.weights[size_t(y) * vertical.stride], vertical.count[y],
+                   rowStride, dst + y * rowStride, srgb);
+  }
+  if (tmp.capacity() > maxRetainedScratch)
+    tmp = {};
+}
+
+namespace {
+uint16_t to565(const int (&c)[3]) {
+  return uint16_t(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 |
+                  ((c[2] * 31 + 127) / 255));
+}
+
+void from565(uint16_t c, int (&rgb)[3]) {
+  int r = (c >> 11) & 31;
+  int g = (c >> 5) & 63;
+  int b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+/// Bounding box encoder along the lines of J.M.P. van Waveren's "Real-Time DXT
+/// Compression", with the diagonal selection from Ignacio Castaño's follow-up.
+void encodeBlock(const uint8_t (&block)[16][3], uint8_t* out) {
+  int lo[3] = {255, 255, 255};
+  int hi[3] = {0, 0, 0};
+  for (auto& pixel : block) {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], int(pixel[c]));
+      hi[c] = std::max(hi[c], int(pixel[c]));
+    }
+  }
+
+  // The box has four diagonals. Pick the one the colors actually spread along, by
+  // looking at the sign of the red/blue and green/blue covariances.
+  int center[3];
+  for (int c = 0; c < 3; c++) center[c] = (lo[c] + hi[c] + 1) / 2;
+  int covRB = 0;
+  int covGB = 0;
+  for (auto& pixel : block) {
+    int b = pixel[2] - center[2];
+    covRB += (pixel[0] - center[0]) * b;
+    covGB += (pixel[1] - center[1]) * b;
+  }
+  if (covRB < 0)
+    std::swap(lo[0], hi[0]);
+  if (covGB < 0)
+    std::swap(lo[1], hi[1]);
+
+  // Inset the endpoints a bit. Few pixels sit exactly on the box corners, so this
+  // lowers the error for all the others.
+  for (int c = 0; c < 3; c++) {
+    int inset = (hi[c] - lo[c]) / 16;
+    hi[c] = std::clamp(hi[c] - inset, 0, 255);
+    lo[c] = std::clamp(lo[c] + inset, 0, 255);
+  }
+
+  uint16_t color0 = to565(hi);
+  uint16_t color1 = to565(lo);
+  // color0 > color1 selects the four color mode
+  if (color0 < color1)
+    std::swap(color0, color1);
+
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    // The palette colors are evenly spaced on the line between the endpoints, so the
+    // closest one is found by projecting onto that line.
+    int end0[3];
+    int end1[3];
+    from565(color0, end0);
+    from565(color1, end1);
+    int axis[3] = {end0[0] - end1[0], end0[1] - end1[1], end0[2] - end1[2]};
+    int length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    // Steps from color1 towards color0 mapped to BC1 indices
+    static constexpr uint32_t stepIndex[4] = {1, 3, 2, 0};
+    for (int i = 0; i < 16; i++) {
+      int projection = (block[i][0] - end1[0]) * axis[0] +
+                       (block[i][1] - end1[1]) * axis[1] +
+                       (block[i][2] - end1[2]) * axis[2];
+      int step = std::clamp((6 * projection + length) / (2 * length), 0, 3);
+      indices |= stepIndex[step] << (2 * i);
+    }
+  }
+
+  out[0] = uint8_t(color0 & 0xFF);
+  out[1] = uint8_t(color0 >> 8);
+  out[2] = uint8_t(color1 & 0xFF);
+  out[3] = uint8_t(color1 >> 8);
+  for (int i = 0; i < 4; i++) out[4 + i] = uint8_t(indices >> (8 * i));
+}
+}  // namespace
+
+void encodeBC1(const uint8_t* src, int width, int height, uint8_t* dst) {
+  uint8_t block[16][3];
+  for (int by = 0; by < height; by += 4) {
+    for (int bx = 0; bx < width; bx += 4) {
+      for (int y = 0; y < 4; y++) {
+        const uint8_t* row = src + size_t(std::min(by + y, height - 1)) * width * 3;
+        for (int x = 0; x < 4; x++) {
+          std::memcpy(block[y * 4 + x], row + std::min(bx + x, width - 1) * 3, 3);
+        }
+      }
+      encodeBlock(block, dst);
+      dst += 8;
+    }
+  }
+}
+
+}  // namespace image_kernels
@@ -0,0 +1,41 @@
+#pragma once
+// Pixel kernels for cover images.
+// This file does not depend on foobar2000 or Windows, so it can be built standalone.
+#include <cstddef>
+#include <cstdint>
+
+namespace image_kernels {
+
+/// Size of the next smaller mip level. Dimensions never drop below 1.
+inline int mipSize(int size) {
+  return size > 1 ? size / 2 : 1;
+}
+
+/// Downsamples a tightly packed RGB8 image to its next mip level with a box filter.
+/// `dst` must hold mipSize(width) * mipSize(height) pixels.
+void downsampleBox(const uint8_t* src, int width, int height, uint8_t* dst);
+
+enum class ResizeFilter {
+  box = 0,
+  bilinear = 1,
+  lanczos3 = 2,
+};
+
+/// Resizes a tightly packed RGB8 image with a separable filter. With `srgb` the image is
+/// filtered in linear light. Otherwise the encoded values are filtered directly, which
+/// is faster but slightly darkens fine, high contrast detail.
+/// Uses SSE2 where available and portable code elsewhere.
+void resize(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst, int dstWidth,
+            int dstHeight, ResizeFilter filter, bool srgb);
+
+/// Size in bytes of a BC1 (DXT1) compressed image
+inline size_t bc1Size(int width, int height) {
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+/// Compresses a tightly packed RGB8 image to BC1 blocks, in row-major block order.
+/// Partial blocks at the right and bottom edges repeat the last column/row.
+/// `dst` must hold bc1Size(width, height) bytes.
+void encodeBC1(const uint8_t* src, int width, int height, uint8_t* dst);
+
+}  // namespace image_kernels
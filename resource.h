@@ -75,6 +75,15 @@
 #define IDC_TEXTCOLOR_CUSTOM 1116
 #define IDC_FONT_CUSTOM 1117
 #define IDC_BG_COLOR_CUSTOM 1118
+#define IDC_PROGRESSIVE_LOADING 1119
+#define IDC_FULL_RES_DISTANCE 1120
+#define IDC_FULL_RES_DISTANCE_SPIN 1121
+#define IDC_RESIZE_FILTER 1122
+#define IDC_RESIZE_SRGB 1123
+#define IDC_UPLOAD_BUDGET 1124
+#define IDC_UPLOAD_BUDGET_SPIN 1125
+#define IDC_MIN_DWELL_TIME 1126
+#define IDC_MIN_DWELL_TIME_SPIN 1127
 
 // Next default values for new objects
 //
@@ -83,7 +92,7 @@
 #define _APS_NO_MFC 1
 #define _APS_NEXT_RESOURCE_VALUE 131
 #define _APS_NEXT_COMMAND_VALUE 40004
-#define _APS_NEXT_CONTROL_VALUE 1119
+#define _APS_NEXT_CONTROL_VALUE 1128
 #define _APS_NEXT_SYMED_VALUE 101
 #endif
 #endif
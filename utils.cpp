@@ -44,6 +44,14 @@ double time() {
   return double(count.QuadPart - resolution_and_offset[1]) / resolution_and_offset[0];
 }
 
+std::wstring profileFile(const char* name) {
+  pfc::string8 path;
+  filesystem::g_get_display_path(core_api::get_profile_path(), path);
+  path.add_byte('\\');
+  path.add_string(name);
+  return wstring_from_utf8(path.c_str());
+}
+
 #ifdef _DEBUG
 namespace console {
 out::out() {
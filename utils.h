@@ -33,6 +33,17 @@ using fn_class = std::integral_constant<decltype(fn), fn>;
 template <typename T, auto fn>
 using unique_ptr_del = std::unique_ptr<T, fn_class<fn>>;
 
+/// 64-bit FNV-1a hash, pass the previous result as `seed` to hash several buffers
+inline t_uint64 fnv1a64(const void* data, size_t len,
+                        t_uint64 seed = 14695981039346656037ull) {
+  auto* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < len; i++) {
+    seed ^= p[i];
+    seed *= 1099511628211ull;
+  }
+  return seed;
+}
+
 struct ILessUtf8 {
   bool operator()(const std::string& a, const std::string& b) const {
     return stricmp_utf8(a.c_str(), b.c_str()) < 0;
@@ -57,6 +68,9 @@ void errorPopupWin32(
 /// Returns the time in seconds with maximum resolution
 double time();
 
+/// Path of the file `name` in the foobar2000 profile directory
+std::wstring profileFile(const char* name);
+
 class FpsCounter {
   struct Frame {
     double end;
@@ -16,6 +16,22 @@ const DBPos& WorldState::getTarget() {
 }
 
 void WorldState::setTarget(DBPos target) {
+  double currentTime = time();
+  auto from = db.iterFromPos(targetPos);
+  auto to = db.iterFromPos(target);
+  if (from && to) {
+    // Smooth over the individual steps of a key repeat or mouse wheel. A change of
+    // direction starts over.
+    float velocity = getTargetVelocity();
+    auto dTime = float(std::max(currentTime - lastTargetChange, 0.01));
+    float stepVelocity = float(db.difference(to.value(), from.value())) / dTime;
+    if (velocity * stepVelocity > 0) {
+      targetVelocity = 0.5f * velocity + 0.5f * stepVelocity;
+    } else {
+      targetVelocity = stepVelocity;
+    }
+  }
+  lastTargetChange = currentTime;
   targetPos = target;
   if (!rendering) {
     lastMovement = time() - 0.02;
@@ -67,6 +83,17 @@ void WorldState::update() {
   lastMovement = currentTime;
 }
 
+float WorldState::getTargetVelocity() const {
+  // Steps further apart than this are separate jumps, not one continuous movement
+  if (time() - lastTargetChange > 0.5)
+    return 0.0f;
+  return targetVelocity;
+}
+
+float WorldState::moveSpeed(float targetDist) {
+  return abs(targetDist2moveDist(targetDist));
+}
+
 float WorldState::targetDist2moveDist(float targetDist) {
   bool goRight = (targetDist > 0.0f);
   targetDist = abs(targetDist);
@@ -74,7 +101,7 @@ float WorldState::targetDist2moveDist(float targetDist) {
          ((0.1f * targetDist * targetDist) + (0.9f * targetDist) + 2.0f);
 }
 
-bool WorldState::isMoving() {
+bool WorldState::isMoving() const {
   return (centeredPos != targetPos) || (centeredOffset != 0);
 }
 
@@ -7,7 +7,7 @@ class WorldState {
  public:
   explicit WorldState(DbAlbumCollection& db);
   void update();
-  bool isMoving();
+  bool isMoving() const;
 
   const DBPos& getCenteredPos() const;
   void hardSetCenteredPos(DBPos pos);
@@ -18,8 +18,15 @@ class WorldState {
   const DBPos& getTarget();
   void setTarget(DBPos target);
 
+  /// How fast the target has been moving recently, in albums per second. Positive when
+  /// moving to the right, zero once the target stood still for a while.
+  float getTargetVelocity() const;
+  /// Speed of the scroll animation in albums per second, when it is `targetDist`
+  /// albums away from the target
+  static float moveSpeed(float targetDist);
+
  private:
-  float targetDist2moveDist(float targetDist);
+  static float targetDist2moveDist(float targetDist);
 
   bool rendering = false;
 
@@ -28,4 +35,6 @@ class WorldState {
   volatile float centeredOffset = 0.0f;
   float lastSpeed = 0.0f;
   double lastMovement = 0.0;
+  float targetVelocity = 0.0f;
+  double lastTargetChange = 0.0;
 };